@@ -1,10 +1,49 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 void init_console(void);
 void *init_testcase(unsigned long max_insns);
 void *init_memory(void);
 long execute_testcase(void *insn, void *gprs, void *mem);
+
+/* A single run with no voting, for packed test cases */
+long execute_testcase_once(void *insn, void *gprs, void *mem);
+
+/* Timebase ticks per second */
+unsigned long timebase_freq(void);
+unsigned long read_timebase(void);
+
+/* Abandon test cases that run for more than ticks timebase ticks, 0 = off */
+void set_watchdog(unsigned long ticks);
+
+/*
+ * How often execute_testcase had to go beyond its first two runs because
+ * they disagreed, and how many extra distinct answers it saw when it did.
+ */
+struct vote_stats {
+	unsigned long tests;
+	unsigned long escalations;
+	unsigned long disagreements;
+};
+extern struct vote_stats vote_stats;
+
+/*
+ * Set by execute_testcase when the test case faulted and was abandoned,
+ * in which case the GPRs are not valid. type is the exception vector on
+ * Microwatt and the signal number on POSIX, 0 if the test case completed.
+ */
+struct testcase_fault {
+	bool timeout;
+	unsigned long type;
+	unsigned long addr;
+	unsigned long msr;
+	unsigned long dar;
+	unsigned long dsisr;
+};
+extern struct testcase_fault testcase_fault;
+
 void putchar_unbuffered(const char c);
+void write_unbuffered(const char *buf, unsigned long len);
 char getchar_unbuffered(void);
 
 #define MEMPAGE_BASE (64*1024)
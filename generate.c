@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "generate.h"
+#include "backend.h"
 #include "lfsr.h"
 #include "jenkins.h"
 #include "helpers.h"
@@ -12,6 +13,10 @@
 #include <stdio.h>
 #endif
 
+#if __STDC_HOSTED__ == 1
+#include <sys/auxv.h>
+#endif
+
 #define OVERFLOW_INSNS	true
 #define DIVIDE_INSNS	true
 #define CARRY_INSNS	true
@@ -25,6 +30,7 @@ struct insn {
 	uint32_t mask;
 	bool enabled;
 	char *name;
+	uint16_t weight;	/* relative pick probability, 0 means 1 */
 };
 
 static struct insn insns[] = {
@@ -302,6 +308,7 @@ struct ldst_insn {
 	uint8_t align;
 	bool enabled;
 	char *name;
+	uint16_t weight;	/* relative pick probability, 0 means 1 */
 };
 
 static struct ldst_insn ldst_insns[] = {
@@ -390,6 +397,257 @@ static unsigned long fxvalues[] = {
 };
 #define NR_FXVALUES (sizeof(fxvalues)/sizeof(fxvalues[0]))
 
+/*
+ * The compatible sampler keeps drawing from the LFSR until it hits an
+ * enabled instruction, which is what golden results were generated with.
+ * The alias sampler picks from a Vose alias table of the enabled entries
+ * with one LFSR step and no modulo, and honours instruction weights.
+ */
+static enum sampler sampler = SAMPLER_COMPAT;
+
+#define MAX_ALIAS	256
+
+struct alias_table {
+	bool valid;
+	unsigned long n;
+	uint32_t prob[MAX_ALIAS];
+	uint16_t pick[MAX_ALIAS];
+	uint16_t alias[MAX_ALIAS];
+};
+
+static struct alias_table insns_alias, ldst_alias;
+
+static void build_alias(struct alias_table *t, const bool *enabled,
+			const uint16_t *weights, unsigned long nr)
+{
+	uint64_t scaled[MAX_ALIAS];
+	uint16_t small[MAX_ALIAS], large[MAX_ALIAS];
+	unsigned long nr_small = 0, nr_large = 0;
+	uint64_t total = 0;
+	unsigned long n = 0;
+
+	for (unsigned long i = 0; i < nr && n < MAX_ALIAS; i++) {
+		if (!enabled[i])
+			continue;
+
+		t->pick[n] = i;
+		scaled[n] = weights[i] ? weights[i] : 1;
+		total += scaled[n];
+		n++;
+	}
+
+	/* Scale so that an average column has weight total */
+	for (unsigned long k = 0; k < n; k++) {
+		scaled[k] *= n;
+		if (scaled[k] < total)
+			small[nr_small++] = k;
+		else
+			large[nr_large++] = k;
+	}
+
+	while (nr_small && nr_large) {
+		unsigned long l = small[--nr_small];
+		unsigned long g = large[--nr_large];
+
+		t->prob[l] = (scaled[l] << 32) / total;
+		t->alias[l] = t->pick[g];
+
+		scaled[g] = scaled[g] + scaled[l] - total;
+		if (scaled[g] < total)
+			small[nr_small++] = g;
+		else
+			large[nr_large++] = g;
+	}
+
+	/* Whatever is left is full, give or take rounding */
+	while (nr_large) {
+		unsigned long g = large[--nr_large];
+
+		t->prob[g] = 0xffffffff;
+		t->alias[g] = t->pick[g];
+	}
+	while (nr_small) {
+		unsigned long l = small[--nr_small];
+
+		t->prob[l] = 0xffffffff;
+		t->alias[l] = t->pick[l];
+	}
+
+	t->n = n;
+	t->valid = true;
+}
+
+_Static_assert(NR_INSNS <= MAX_ALIAS && NR_LDST_INSNS <= MAX_ALIAS,
+	       "Increase MAX_ALIAS");
+
+static void build_alias_tables(void)
+{
+	bool enabled[MAX_ALIAS];
+	uint16_t weights[MAX_ALIAS];
+
+	if (!insns_alias.valid) {
+		for (unsigned long i = 0; i < NR_INSNS && i < MAX_ALIAS; i++) {
+			enabled[i] = insns[i].enabled;
+			weights[i] = insns[i].weight;
+		}
+		build_alias(&insns_alias, enabled, weights, NR_INSNS);
+	}
+
+	if (!ldst_alias.valid) {
+		for (unsigned long i = 0; i < NR_LDST_INSNS && i < MAX_ALIAS; i++) {
+			enabled[i] = ldst_insns[i].enabled;
+			weights[i] = ldst_insns[i].weight;
+		}
+		build_alias(&ldst_alias, enabled, weights, NR_LDST_INSNS);
+	}
+}
+
+static inline uint32_t alias_pick(struct alias_table *t, uint32_t r)
+{
+	uint64_t x = (uint64_t)r * t->n;
+	uint32_t k = x >> 32;
+
+	/* The high half picks the column, the low half tosses the coin */
+	return ((uint32_t)x < t->prob[k]) ? t->pick[k] : t->alias[k];
+}
+
+void set_sampler(enum sampler s)
+{
+	sampler = s;
+}
+
+enum sampler get_sampler(void)
+{
+	return sampler;
+}
+
+/*
+ * Instruction mix profiles. Each one sets how often a load/store is
+ * emitted (one every ldst_mask+1 slots) and weights instruction classes
+ * using the alias sampler. The default profile is what golden results
+ * were generated with.
+ */
+struct profile_weight {
+	const char *insn;
+	uint16_t weight;
+};
+
+struct profile {
+	const char *name;
+	unsigned long ldst_mask;
+	enum sampler sampler;
+	const struct profile_weight *weights;
+};
+
+static const struct profile_weight no_weights[] = {
+	{ NULL, 0 },
+};
+
+static const struct profile_weight alu_weights[] = {
+	{ "add*", 4 }, { "sub*", 4 }, { "neg*", 4 },
+	{ "and*", 4 }, { "or*", 4 }, { "xor*", 4 }, { "nand*", 4 },
+	{ "nor*", 4 }, { "eqv*", 4 }, { "ext*", 4 }, { "cnt*", 4 },
+	{ "rl*", 4 }, { "sl*", 4 }, { "sr*", 4 }, { "popcnt*", 4 },
+	{ NULL, 0 },
+};
+
+static const struct profile_weight cr_weights[] = {
+	{ "cr*", 8 }, { "mcrf", 8 }, { "mfocrf", 8 }, { "mtocrf", 8 },
+	{ "mfcr", 8 }, { "mtcrf", 8 }, { "isel*", 8 }, { "cmp*", 8 },
+	{ "setb", 8 }, { "bc", 8 },
+	{ NULL, 0 },
+};
+
+static const struct profile_weight divide_weights[] = {
+	{ "div*", 16 }, { "mod*", 16 }, { "mul*", 4 },
+	{ NULL, 0 },
+};
+
+static const struct profile_weight carry_weights[] = {
+	{ "addc*", 8 }, { "addic*", 8 }, { "addze*", 8 }, { "adde*", 8 },
+	{ "addme*", 8 }, { "subfc*", 8 }, { "subfic", 8 }, { "subfe*", 8 },
+	{ "subfme*", 8 }, { "subfze*", 8 }, { "mfxer", 8 }, { "mtxer", 8 },
+	{ NULL, 0 },
+};
+
+static const struct profile profiles[] = {
+	{ "default",		0x1f,	SAMPLER_COMPAT,	no_weights },
+	{ "alu-heavy",		0x7f,	SAMPLER_ALIAS,	alu_weights },
+	{ "ldst-heavy",		0x3,	SAMPLER_ALIAS,	no_weights },
+	{ "cr-heavy",		0x1f,	SAMPLER_ALIAS,	cr_weights },
+	{ "divide-storm",	0x3f,	SAMPLER_ALIAS,	divide_weights },
+	{ "carry-heavy",	0x1f,	SAMPLER_ALIAS,	carry_weights },
+};
+#define NR_PROFILES (sizeof(profiles) / sizeof(struct profile))
+
+static const struct profile *profile = &profiles[0];
+static unsigned long ldst_mask = 0x1f;
+
+bool set_profile(const char *name)
+{
+	const struct profile *p = NULL;
+
+	for (unsigned long i = 0; i < NR_PROFILES; i++)
+		if (!strcmp(profiles[i].name, name))
+			p = &profiles[i];
+
+	if (!p)
+		return false;
+
+	for (unsigned long i = 0; i < NR_INSNS; i++)
+		insns[i].weight = 0;
+	for (unsigned long i = 0; i < NR_LDST_INSNS; i++)
+		ldst_insns[i].weight = 0;
+
+	for (const struct profile_weight *w = p->weights; w->insn; w++)
+		weight_insn(w->insn, w->weight);
+
+	ldst_mask = p->ldst_mask;
+	sampler = p->sampler;
+	insns_alias.valid = false;
+	ldst_alias.valid = false;
+	profile = p;
+
+	return true;
+}
+
+const char *get_profile(void)
+{
+	return profile->name;
+}
+
+void list_profiles(void)
+{
+	for (unsigned long i = 0; i < NR_PROFILES; i++) {
+		print(profiles[i].name);
+		print("\r\n");
+	}
+}
+
+/*
+ * A hash of everything that decides what gets generated for a given seed:
+ * enabled instructions, weights, load/store rate and sampler.
+ */
+uint32_t generator_fingerprint(void)
+{
+	uint32_t v[2] = { ldst_mask, sampler };
+	uint32_t h = 0;
+
+	for (unsigned long i = 0; i < NR_INSNS; i++) {
+		uint32_t w = (insns[i].enabled << 16) | insns[i].weight;
+
+		h = jhash2(&w, 1, h);
+	}
+
+	for (unsigned long i = 0; i < NR_LDST_INSNS; i++) {
+		uint32_t w = (ldst_insns[i].enabled << 16) | ldst_insns[i].weight;
+
+		h = jhash2(&w, 1, h);
+	}
+
+	return jhash2(v, 2, h);
+}
+
 #define PPC_OPCODE(OPC)		((OPC) << 26)
 #define PPC_RT(RT)		((RT) << 21)
 #define PPC_RS(RS)		((RS) << 21)
@@ -402,8 +660,17 @@ static unsigned long fxvalues[] = {
 #define ORIS(RS, RA, UI)	(PPC_OPCODE(25) | PPC_RS(RS) | PPC_RA(RA) | ((UI) & 0xffff))
 #define ORI(RS, RA, UI)		(PPC_OPCODE(24) | PPC_RS(RS) | PPC_RA(RA) | ((UI) & 0xffff))
 #define STD(RS, RA, DS)		(PPC_OPCODE(62) | PPC_RS(RS) | PPC_RA(RA) | DS)
+#define LD(RT, RA, DS)		(PPC_OPCODE(58) | PPC_RT(RT) | PPC_RA(RA) | DS)
+#define MFSPR(RT, SPR)		(PPC_OPCODE(31) | PPC_RT(RT) | (((SPR) & 0x1f) << 16) | ((((SPR) >> 5) & 0x1f) << 11) | (339 << 1))
 #define RLDICR(RA, RS, SH, ME)	(PPC_OPCODE(30) | PPC_RA(RA) | PPC_RS(RS) | PPC_SH(SH) | PPC_ME(ME) | 4)
 #define NOP			0x60000000
+#define ADDI(RT, RA, SI)	(PPC_OPCODE(14) | PPC_RT(RT) | PPC_RA(RA) | ((SI) & 0xffff))
+#define MFCR(RT)		(PPC_OPCODE(31) | PPC_RT(RT) | (19 << 1))
+#define STWCX(RS, RA, RB)	(PPC_OPCODE(31) | PPC_RS(RS) | PPC_RA(RA) | PPC_RB(RB) | (150 << 1) | 1)
+
+#define SPR_XER			1
+#define SPR_LR			8
+#define SPR_CTR			9
 
 static void *load_64bit_imm(uint32_t *p, int gpr, uint64_t val)
 {
@@ -416,8 +683,58 @@ static void *load_64bit_imm(uint32_t *p, int gpr, uint64_t val)
 	return p;
 }
 
+static bool relocatable;
+
+void set_relocatable(bool on)
+{
+	relocatable = on;
+}
+
+bool get_relocatable(void)
+{
+	return relocatable;
+}
+
+static bool gpr_table;
+
+void set_gpr_table(bool on)
+{
+	gpr_table = on;
+}
+
+bool get_gpr_table(void)
+{
+	return gpr_table;
+}
+
+/*
+ * Load the memory window pointer into gpr. In relocatable mode it comes
+ * from the prolog's stack frame, which we find via TAR. tmp is used for
+ * the stack pointer and must not be r0, since RA=0 means 0 to ld.
+ */
+static void *load_mem_ptr(uint32_t *p, int gpr, int tmp, void *mem, bool reloc)
+{
+	if (!reloc)
+		return load_64bit_imm(p, gpr, (unsigned long)mem);
+
+	*p++ = MFSPR(tmp, SPR_TAR);
+	*p++ = LD(gpr, tmp, RELOC_MEM_OFFSET);
+
+	return p;
+}
+
+/* The last test instruction we generated, for bisect */
+static const char *last_name;
+static uint32_t last_insn;
+
+const char *last_generated_insn(uint32_t *insn)
+{
+	*insn = last_insn;
+	return last_name;
+}
+
 static void *do_one_loadstore(uint32_t *p, void *mem, struct ldst_insn *insnp,
-			      uint32_t *lfsr, bool print_insns)
+			      uint32_t *lfsr, bool print_insns, bool reloc)
 {
 	uint32_t insn = insnp->opcode;
 	uint64_t off;
@@ -455,8 +772,11 @@ static void *do_one_loadstore(uint32_t *p, void *mem, struct ldst_insn *insnp,
 		}
 		rt = (ra + 1) % 32;
 
-		/* if RA=R0 the hardware uses 0, so put the base in RB */
-		p = load_64bit_imm(p, rb, (unsigned long)mem);
+		/*
+		 * if RA=R0 the hardware uses 0, so put the base in RB. RA gets
+		 * overwritten with the offset, so it can be our temporary.
+		 */
+		p = load_mem_ptr(p, rb, ra ? ra : rb, mem, reloc);
 
 		p = load_64bit_imm(p, ra, off);
 		insn |= PPC_RT(rt) | PPC_RA(ra) | PPC_RB(rb);
@@ -474,7 +794,7 @@ static void *do_one_loadstore(uint32_t *p, void *mem, struct ldst_insn *insnp,
 
 		rt = (ra + 1) % 32;
 
-		p = load_64bit_imm(p, ra, (unsigned long)mem);
+		p = load_mem_ptr(p, ra, ra, mem, reloc);
 
 		insn |= PPC_RT(rt) | PPC_RA(ra) | (off & 0xffff & insnp->mask);
 	}
@@ -486,33 +806,83 @@ static void *do_one_loadstore(uint32_t *p, void *mem, struct ldst_insn *insnp,
 		print("\r\n");
 	}
 
+	last_name = insnp->name;
+	last_insn = insn;
 	*p++ = insn;
 
 	return p;
 }
 
-#define CACHELINE_SIZE 32
+/*
+ * Bare metal builds set the line size of their core, anything else starts
+ * with the smallest one we know of and asks the kernel in icache_init.
+ */
+#ifndef ICACHE_LINE_SIZE
+#define ICACHE_LINE_SIZE 32
+#endif
+
+static unsigned long dcache_line = ICACHE_LINE_SIZE;
+static unsigned long icache_line = ICACHE_LINE_SIZE;
+
+void icache_init(void)
+{
+#if __STDC_HOSTED__ == 1 && defined(AT_DCACHEBSIZE)
+	unsigned long d = getauxval(AT_DCACHEBSIZE);
+	unsigned long i = getauxval(AT_ICACHEBSIZE);
+
+	/* 0 if the kernel didn't tell us */
+	if (d)
+		dcache_line = d;
+	if (i)
+		icache_line = i;
+#endif
+}
 
-static inline void icache_flush(void *start, void *end)
+/* Nothing to do when the host build interprets the test case */
+void icache_flush(void *start, void *end)
 {
-	for (void *p = start; p < end; p += CACHELINE_SIZE)
+#if defined(__powerpc__)
+	void *p;
+
+	/* start might not be line aligned, and we mustn't miss the last one */
+	for (p = (void *)((unsigned long)start & ~(dcache_line - 1)); p < end;
+	     p += dcache_line)
 		asm volatile("dcbst 0,%0": : "r"(p));
 
 	asm volatile("sync":::"memory");
 
-	for (void *p = start; p < end; p += CACHELINE_SIZE)
+	for (p = (void *)((unsigned long)start & ~(icache_line - 1)); p < end;
+	     p += icache_line)
 		asm volatile("icbi 0,%0": : "r"(p));
 
 	asm volatile("isync":::"memory");
+#endif
 }
 
+/*
+ * generate_testcase and install_testcase write the same prolog to the same
+ * place for every seed, so once it has been flushed only what comes after
+ * it is dirty.
+ * Anything that writes a different prolog there has to forget it.
+ */
+static struct {
+	void *start;
+	void *end;
+	bool reloc;
+} clean_prolog;
+
 #define TRAP_INSN	0x7fe00008
 
-void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
-		        unsigned long nr_insns, bool print_insns, bool sim)
+/* Where the last sim test case ends, any other trap is a program check */
+static void *sim_trap;
+
+bool is_sim_trap(uint64_t addr)
+{
+	return sim_trap && addr == (uintptr_t)sim_trap;
+}
+
+static uint32_t seed_lfsr(unsigned long seed)
 {
-	void *start = ptr;
-	uint32_t *p;
 	uint32_t lfsr = seed;
 
 	/* LFSR needs a non zero value to work */
@@ -520,23 +890,33 @@ void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
 		lfsr = 0xffffffff;
 
 	/* Hash the LFSR seed so we get better early values */
-	lfsr = jhash2(&lfsr, 1, 0);
+	return jhash2(&lfsr, 1, 0);
+}
 
-	/* Prolog */
-	if (!sim) {
-		memcpy(ptr, prolog1_start, prolog1_end-prolog1_start);
-	} else {
-		/*
-		 * We need to pad with nops so that the test case always
-		 * runs at the same address.
-		 */
-		for (unsigned long i = 0; i < (prolog1_end-prolog1_start); i += sizeof(uint32_t))
-			*(uint32_t *)(ptr+i) = NOP;
-	}
-	ptr += prolog1_end-prolog1_start;
+static bool alias_sampler(void)
+{
+	if (sampler != SAMPLER_ALIAS)
+		return false;
 
-	memcpy(ptr, prolog2_start, prolog2_end-prolog2_start);
-	ptr += prolog2_end-prolog2_start;
+	if (!insns_alias.valid || !ldst_alias.valid)
+		build_alias_tables();
+
+	/* Nothing enabled, the compatible sampler hangs just the same */
+	return insns_alias.n && ldst_alias.n;
+}
+
+/*
+ * The GPR init and the random instructions, everything that is per seed.
+ * With a table the initial values are written there and loaded with one
+ * ld each from r31, which goes last, instead of five instructions each.
+ * The registers end up the same either way.
+ */
+static void *generate_body(void *ptr, void *mem, uint32_t lfsr,
+			   unsigned long nr_insns, bool print_insns,
+			   bool reloc, bool use_alias, uint64_t *table)
+{
+	if (table)
+		ptr = load_64bit_imm(ptr, 31, (uint64_t)table);
 
 	/* Initialize GPRs */
 	for (unsigned long i = 0; i < 32; i++) {
@@ -545,7 +925,13 @@ void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
 		lfsr = mylfsr(32, lfsr);
 
 		val = fxvalues[lfsr % NR_FXVALUES];
-		ptr = load_64bit_imm(ptr, i, val);
+		if (table) {
+			table[i] = val;
+			*(uint32_t *)ptr = LD(i, 31, i*sizeof(uint64_t));
+			ptr += sizeof(uint32_t);
+		} else {
+			ptr = load_64bit_imm(ptr, i, val);
+		}
 	}
 
 	/* At this point we can start the test */
@@ -553,19 +939,29 @@ void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
 		uint32_t j;
 		uint32_t insn;
 
-		if (LOADSTORE_INSNS && !(i & 0x1f)) {
-			do {
+		if (LOADSTORE_INSNS && !(i & ldst_mask)) {
+			if (use_alias) {
 				lfsr = mylfsr(32, lfsr);
-				j = lfsr % NR_LDST_INSNS;
-			} while (ldst_insns[j].enabled == false);
+				j = alias_pick(&ldst_alias, lfsr);
+			} else {
+				do {
+					lfsr = mylfsr(32, lfsr);
+					j = lfsr % NR_LDST_INSNS;
+				} while (ldst_insns[j].enabled == false);
+			}
 
 			ptr = do_one_loadstore(ptr, mem, &ldst_insns[j],
-					       &lfsr, print_insns);
+					       &lfsr, print_insns, reloc);
 		} else {
-			do {
+			if (use_alias) {
 				lfsr = mylfsr(32, lfsr);
-				j = lfsr % NR_INSNS;
-			} while (insns[j].enabled == false);
+				j = alias_pick(&insns_alias, lfsr);
+			} else {
+				do {
+					lfsr = mylfsr(32, lfsr);
+					j = lfsr % NR_INSNS;
+				} while (insns[j].enabled == false);
+			}
 
 			lfsr = mylfsr(32, lfsr);
 			insn = insns[j].opcode | (lfsr & insns[j].mask);
@@ -577,11 +973,69 @@ void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
 				print("\r\n");
 			}
 
+			last_name = insns[j].name;
+			last_insn = insn;
 			*(uint32_t *)ptr = insn;
 			ptr += sizeof(uint32_t);
 		}
 	}
 
+	return ptr;
+}
+
+/* Store GPRs 0-30 to save, r31 is the pointer */
+static void *save_gprs(uint32_t *p, void *save)
+{
+	p = load_64bit_imm(p, 31, (uint64_t)save);
+
+	for (unsigned long i = 0; i < 31; i++)
+		*p++ = STD(i, 31, i*sizeof(uint64_t));
+
+	return p;
+}
+
+/* Everything but the icache flush, *prolog_end is where the body starts */
+static void *build_testcase(void *ptr, void *mem, void *save,
+			    unsigned long seed, unsigned long nr_insns,
+			    bool print_insns, bool sim, void **prolog_end)
+{
+	uint32_t *p;
+	/* The simulator layout is always absolute */
+	bool reloc = relocatable && !sim;
+	/* and always loads immediates, the simulators only get the code */
+	uint64_t *table = NULL;
+
+	if (gpr_table && !sim && !reloc)
+		table = (uint64_t *)save + NGPRS;
+
+	last_name = NULL;
+
+	/* Prolog */
+	if (!sim) {
+		memcpy(ptr, prolog1_start, prolog1_end-prolog1_start);
+	} else {
+		/*
+		 * We need to pad with nops so that the test case always
+		 * runs at the same address.
+		 */
+		for (unsigned long i = 0; i < (prolog1_end-prolog1_start); i += sizeof(uint32_t))
+			*(uint32_t *)(ptr+i) = NOP;
+	}
+	ptr += prolog1_end-prolog1_start;
+
+	if (reloc) {
+		memcpy(ptr, prolog_reloc_start,
+		       prolog_reloc_end-prolog_reloc_start);
+		ptr += prolog_reloc_end-prolog_reloc_start;
+	}
+
+	memcpy(ptr, prolog2_start, prolog2_end-prolog2_start);
+	ptr += prolog2_end-prolog2_start;
+	*prolog_end = ptr;
+
+	ptr = generate_body(ptr, mem, seed_lfsr(seed), nr_insns, print_insns,
+			    reloc, alias_sampler(), table);
+
 	/* First epilog */
 	memcpy(ptr, epilog1_start, epilog1_end-epilog1_start);
 	ptr += epilog1_end-epilog1_start;
@@ -592,23 +1046,194 @@ void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
 	} else {
 		/*
 		 * At this point r31 is free, create a pointer to our
-		 * save area and write the GPRs out. Assume address is in
-		 * the low 32 bits.
+		 * save area and write the GPRs out.
 		 */
-		ptr = load_64bit_imm(ptr, 31, (uint64_t)save);
-
-		p = ptr;
-		/* Save GPR 0-31 to our save area */
-		for (unsigned long i = 0; i < 31; i++)
-			*p++ = STD(i, 31, i*sizeof(uint64_t));
-		ptr = p;
+		if (reloc) {
+			p = ptr;
+			*p++ = MFSPR(31, SPR_TAR);
+			*p++ = LD(31, 31, RELOC_SAVE_OFFSET);
+
+			/* Save GPR 0-31 to our save area */
+			for (unsigned long i = 0; i < 31; i++)
+				*p++ = STD(i, 31, i*sizeof(uint64_t));
+			ptr = p;
+		} else {
+			ptr = save_gprs(ptr, save);
+		}
 
 		/* Second epilog */
 		memcpy(ptr, epilog2_start, epilog2_end-epilog2_start);
 		ptr += epilog2_end-epilog2_start;
+	}
+
+	return ptr;
+}
 
+void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed,
+		        unsigned long nr_insns, bool print_insns, bool sim)
+{
+	void *start = ptr, *prolog_end;
+	bool reloc = relocatable && !sim;
+
+	ptr = build_testcase(ptr, mem, save, seed, nr_insns, print_insns, sim,
+			     &prolog_end);
+
+	if (sim) {
+		/* The nop padding replaced the prolog */
+		clean_prolog.start = NULL;
+		sim_trap = ptr - sizeof(uint32_t);
+		return ptr;
+	}
+
+	sim_trap = NULL;
+
+	if (start == clean_prolog.start &&
+	    prolog_end == clean_prolog.end && reloc == clean_prolog.reloc)
+		icache_flush(prolog_end, ptr);
+	else
 		icache_flush(start, ptr);
+
+	clean_prolog.start = start;
+	clean_prolog.end = prolog_end;
+	clean_prolog.reloc = reloc;
+
+	return ptr;
+}
+
+/*
+ * For a test case built away from the code page, eg by another thread,
+ * and copied there by install_testcase. There is no icache flush, and
+ * *prolog_len is how much of it is the prolog every seed shares.
+ */
+void *generate_staged(void *ptr, void *mem, void *save, unsigned long seed,
+		      unsigned long nr_insns, unsigned long *prolog_len)
+{
+	void *prolog_end;
+	void *end;
+
+	end = build_testcase(ptr, mem, save, seed, nr_insns, false, false,
+			     &prolog_end);
+	*prolog_len = prolog_end - ptr;
+
+	return end;
+}
+
+/*
+ * Copy a staged test case to dst and flush it. Like generate_testcase,
+ * the prolog is left alone if dst already has it.
+ */
+void install_testcase(void *dst, const void *src, unsigned long len,
+		      unsigned long prolog_len)
+{
+	unsigned long skip = 0;
+
+	if (dst == clean_prolog.start && dst + prolog_len == clean_prolog.end &&
+	    relocatable == clean_prolog.reloc)
+		skip = prolog_len;
+
+	memcpy(dst + skip, src + skip, len - skip);
+	icache_flush(dst + skip, dst + len);
+
+	clean_prolog.start = dst;
+	clean_prolog.end = dst + prolog_len;
+	clean_prolog.reloc = relocatable;
+}
+
+/*
+ * Worst case size in bytes of a packed body: the window clear, prolog2,
+ * GPR init, a load/store (nop, two 64 bit immediates and the insn) for
+ * every insn, epilog1, the GPR save, the SPR saves and the done mark.
+ */
+static unsigned long packed_body_size(unsigned long nr_insns)
+{
+	unsigned long words = 7 + MEM_SIZE / sizeof(uint64_t) + 32*5 +
+			      nr_insns*12 + 5 + 31 + 8 + 1;
+
+	return words * sizeof(uint32_t) + (prolog2_end-prolog2_start) +
+	       (epilog1_end-epilog1_start);
+}
+
+/*
+ * Packed test cases: up to *nr_seeds consecutive seeds back to back
+ * behind one prolog and epilog, for short test cases where the call and
+ * the non volatile save and restore cost more than the test itself. Each
+ * body first clears the reservation and the memory window, then runs
+ * prolog2 and the usual GPR init and insns, and stores its registers in
+ * the same layout as a normal save area at save + (k + 1) * NGPRS. Slot 0
+ * belongs to the prolog and epilog. With set_gpr_table a body's slot is
+ * also its GPR table, the results overwrite it. GPR 31 is the scratch
+ * register, so once the body is done its entry is free: a body that gets
+ * to the end stores its slot address there, and the first slot without
+ * one is the body that faulted or trapped.
+ *
+ * Packing stops early if the next body might not fit before end, and
+ * *nr_seeds is updated. Always absolute, there is no relocatable version.
+ */
+void *generate_packed(void *ptr, void *end, void *mem, void *save,
+		      unsigned long seed, unsigned long *nr_seeds,
+		      unsigned long nr_insns)
+{
+	void *start = ptr;
+	bool use_alias = alias_sampler();
+	/* A body, plus room for the final epilog */
+	unsigned long need = packed_body_size(nr_insns) +
+			     5 * sizeof(uint32_t) + (epilog2_end-epilog2_start);
+	uint64_t *slot = save;
+	unsigned long k;
+	uint32_t *p;
+
+	last_name = NULL;
+	clean_prolog.start = NULL;
+
+	memcpy(ptr, prolog1_start, prolog1_end-prolog1_start);
+	ptr += prolog1_end-prolog1_start;
+
+	for (k = 0; k < *nr_seeds; k++) {
+		if (ptr + need > end)
+			break;
+
+		slot += NGPRS;
+
+		/* What execute_testcase does between test cases */
+		p = ptr;
+		*p++ = ADDI(0, 0, 0);
+		p = load_64bit_imm(p, 31, (uint64_t)(mem - MEM_SIZE/2));
+		*p++ = STWCX(0, 0, 31);
+		for (unsigned long i = 0; i < MEM_SIZE; i += sizeof(uint64_t))
+			*p++ = STD(0, 31, i);
+		ptr = p;
+
+		memcpy(ptr, prolog2_start, prolog2_end-prolog2_start);
+		ptr += prolog2_end-prolog2_start;
+
+		ptr = generate_body(ptr, mem, seed_lfsr(seed + k), nr_insns,
+				    false, false, use_alias,
+				    gpr_table ? slot : NULL);
+
+		memcpy(ptr, epilog1_start, epilog1_end-epilog1_start);
+		ptr += epilog1_end-epilog1_start;
+
+		/* The first half of epilog2, into this body's slot */
+		p = save_gprs(ptr, slot);
+		*p++ = MFCR(0);
+		*p++ = STD(0, 31, 256);
+		*p++ = MFSPR(0, SPR_LR);
+		*p++ = STD(0, 31, 264);
+		*p++ = MFSPR(0, SPR_CTR);
+		*p++ = STD(0, 31, 272);
+		*p++ = MFSPR(0, SPR_XER);
+		*p++ = STD(0, 31, 280);
+		*p++ = STD(31, 31, 248);
+		ptr = p;
 	}
+	*nr_seeds = k;
+
+	/* Slot 0 has the stack pointer from prolog1 */
+	ptr = load_64bit_imm(ptr, 31, (uint64_t)save);
+	memcpy(ptr, epilog2_start, epilog2_end-epilog2_start);
+	ptr += epilog2_end-epilog2_start;
+
+	icache_flush(start, ptr);
 
 	return ptr;
 }
@@ -630,6 +1255,7 @@ void enable_insn(const char *insn)
 			print(insns[i].name);
 			print("\r\n");
 			insns[i].enabled = true;
+			insns_alias.valid = false;
 		}
 	}
 }
@@ -651,6 +1277,37 @@ void disable_insn(const char *insn)
 			print(insns[i].name);
 			print("\r\n");
 			insns[i].enabled = false;
+			insns_alias.valid = false;
+		}
+	}
+}
+
+/* Only used by the alias sampler */
+void weight_insn(const char *insn, unsigned long weight)
+{
+	size_t l;
+	bool wild = false;
+
+	if (weight > 0xffff)
+		weight = 0xffff;
+
+	l = strlen(insn);
+	if (l > 0 && insn[l-1] == '*') {
+		--l;
+		wild = true;
+	}
+	for (unsigned long i = 0; i < NR_INSNS; i++) {
+		if (!strncmp(insns[i].name, insn, l) &&
+		    (wild || insn[l] == 0)) {
+			insns[i].weight = weight;
+			insns_alias.valid = false;
+		}
+	}
+	for (unsigned long i = 0; i < NR_LDST_INSNS; i++) {
+		if (!strncmp(ldst_insns[i].name, insn, l) &&
+		    (wild || insn[l] == 0)) {
+			ldst_insns[i].weight = weight;
+			ldst_alias.valid = false;
 		}
 	}
 }
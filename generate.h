@@ -1,3 +1,38 @@
+#include <stdint.h>
+#include <stdbool.h>
+
 void *generate_testcase(void *ptr, void *mem, void *save, unsigned long seed, unsigned long nr_insns, bool print_insns, bool sim);
+void *generate_staged(void *ptr, void *mem, void *save, unsigned long seed,
+		      unsigned long nr_insns, unsigned long *prolog_len);
+void install_testcase(void *dst, const void *src, unsigned long len,
+		      unsigned long prolog_len);
+void *generate_packed(void *ptr, void *end, void *mem, void *save,
+		      unsigned long seed, unsigned long *nr_seeds,
+		      unsigned long nr_insns);
+const char *last_generated_insn(uint32_t *insn);
+bool is_sim_trap(uint64_t addr);
+void icache_init(void);
+void icache_flush(void *start, void *end);
 void enable_insn(const char *insn);
 void disable_insn(const char *insn);
+void set_relocatable(bool on);
+bool get_relocatable(void);
+
+/*
+ * Load the initial GPRs from a table instead of immediates. The table
+ * goes straight after the NGPRS words of the save area, so save areas
+ * passed to generate_testcase need NGPRS + GPR_TABLE_WORDS.
+ */
+#define GPR_TABLE_WORDS	32
+void set_gpr_table(bool on);
+bool get_gpr_table(void);
+
+enum sampler { SAMPLER_COMPAT, SAMPLER_ALIAS };
+void set_sampler(enum sampler s);
+enum sampler get_sampler(void);
+void weight_insn(const char *insn, unsigned long weight);
+
+bool set_profile(const char *name);
+const char *get_profile(void);
+void list_profiles(void);
+uint32_t generator_fingerprint(void);
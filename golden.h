@@ -0,0 +1,10 @@
+#include <stdint.h>
+
+/*
+ * Expected jenkins hashes for golden_count consecutive seeds starting at
+ * golden_first_seed, generated by microwatt/golden.py.
+ */
+extern const unsigned long golden_first_seed;
+extern const unsigned long golden_nr_insns;
+extern const unsigned long golden_count;
+extern const uint32_t golden_hashes[];
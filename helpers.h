@@ -1 +1,13 @@
+/*
+ * In relocatable mode the prolog stashes the save area and memory window
+ * pointers in its stack frame, and keeps the stack pointer in TAR where
+ * the test case can't touch it.
+ */
+#define SPR_TAR			815
+#define RELOC_SAVE_OFFSET	184
+#define RELOC_MEM_OFFSET	192
+
+#ifndef __ASSEMBLER__
 extern char prolog1_start[], prolog1_end[], prolog2_start[], prolog2_end[], epilog1_start[], epilog1_end[], epilog2_start[], epilog2_end[];
+extern char prolog_reloc_start[], prolog_reloc_end[];
+#endif
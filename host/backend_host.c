@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include "backend.h"
+#include "generate.h"
+#include "interp.h"
+
+/*
+ * Runs test cases through the reference interpreter instead of a POWER
+ * core, so golden files can be made on any Linux box. The timebase is
+ * CLOCK_MONOTONIC in ns, and the watchdog counts instructions.
+ */
+#define TB_FREQ		1000000000UL
+
+/* Where the interpreter returns to, anything outside the regions will do */
+#define RETURN_ADDR	0x4
+
+#define STACK_SIZE	1024
+
+static void *mempage;
+static unsigned long watchdog_ticks;
+static uint64_t stack[STACK_SIZE / sizeof(uint64_t)];
+
+/* Meant for batch runs, leave the terminal alone */
+void init_console(void)
+{
+}
+
+unsigned long timebase_freq(void)
+{
+	return TB_FREQ;
+}
+
+unsigned long read_timebase(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * TB_FREQ + ts.tv_nsec;
+}
+
+void set_watchdog(unsigned long ticks)
+{
+	watchdog_ticks = ticks;
+}
+
+void *init_testcase(unsigned long max_insns)
+{
+	void *p;
+
+	/* Same as POSIX, golden results need the fixed addresses */
+	p = mmap((void *)MEMPAGE_BASE, MEMPAGE_SIZE, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (p != (void *)MEMPAGE_BASE) {
+		if (p != MAP_FAILED)
+			munmap(p, MEMPAGE_SIZE);
+
+		p = mmap(NULL, MEMPAGE_SIZE, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+
+		fprintf(stderr, "Could not map test case at 0x%x, results "
+			"will not match golden files\n", MEMPAGE_BASE);
+		set_relocatable(true);
+	}
+
+	memset(p, 0, MEMPAGE_SIZE);
+	mempage = p;
+
+	return mempage + (INSNS_BASE - MEMPAGE_BASE);
+}
+
+void *init_memory(void)
+{
+	return mempage + (MEM_BASE - MEMPAGE_BASE);
+}
+
+struct vote_stats vote_stats;
+struct testcase_fault testcase_fault;
+
+long execute_testcase_once(void *insns, void *gprs, void *mem_ptr)
+{
+	static struct interp s;
+	uint64_t *regs = gprs;
+	long tb_start, tb_end;
+	enum interp_stop stop;
+
+	testcase_fault.type = 0;
+	testcase_fault.timeout = false;
+
+	memset(mem_ptr, 0, MEM_SIZE);
+
+	interp_init(&s);
+	interp_add_region(&s, mempage, MEMPAGE_SIZE);
+	/* The save area, and the GPR table after it */
+	interp_add_region(&s, gprs, (NGPRS + GPR_TABLE_WORDS) * sizeof(uint64_t));
+	interp_add_region(&s, stack, sizeof(stack));
+
+	s.gpr[1] = (uintptr_t)&stack[STACK_SIZE / sizeof(uint64_t) / 2];
+	s.gpr[3] = (uintptr_t)gprs;
+	s.gpr[4] = (uintptr_t)(mem_ptr + MEM_SIZE/2);
+	s.lr = RETURN_ADDR;
+	s.pc = (uintptr_t)insns;
+
+	tb_start = read_timebase();
+	stop = interp_run(&s, RETURN_ADDR, watchdog_ticks);
+	tb_end = read_timebase();
+
+	switch (stop) {
+	case INTERP_RETURN:
+		break;
+
+	case INTERP_TRAP:
+		if (is_sim_trap(s.pc)) {
+			/* The end of a sim test case, the results are still live */
+			memcpy(regs, s.gpr, sizeof(s.gpr));
+			regs[32] = s.cr;
+			regs[33] = s.lr;
+			regs[34] = s.ctr;
+			regs[35] = s.xer;
+			break;
+		}
+		/* A trap in the body is a program check, as on hardware */
+		/* fallthrough */
+	case INTERP_FAULT:
+		testcase_fault.type = s.fault_type;
+		testcase_fault.addr = s.fault_addr;
+		testcase_fault.msr = s.srr1;
+		testcase_fault.dar = s.dar;
+		break;
+
+	case INTERP_TIMEOUT:
+		testcase_fault.timeout = true;
+		testcase_fault.type = 0x900;
+		testcase_fault.addr = s.pc;
+		break;
+	}
+
+	return tb_end - tb_start;
+}
+
+/* The model always gives the same answer */
+long execute_testcase(void *insns, void *gprs, void *mem_ptr)
+{
+	vote_stats.tests++;
+
+	return execute_testcase_once(insns, gprs, mem_ptr);
+}
+
+void putchar_unbuffered(const char c)
+{
+	putchar(c);
+}
+
+void write_unbuffered(const char *buf, unsigned long len)
+{
+	fwrite(buf, 1, len, stdout);
+}
+
+static char inbuf[4096];
+static ssize_t inbuf_pos, inbuf_len;
+
+char getchar_unbuffered(void)
+{
+	if (inbuf_pos == inbuf_len) {
+		/* Make sure the prompt is out before we block */
+		fflush(stdout);
+
+		do {
+			inbuf_len = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+		} while (inbuf_len < 0 && errno == EINTR);
+
+		/* Nothing more to read, we are done */
+		if (inbuf_len <= 0)
+			exit(0);
+
+		inbuf_pos = 0;
+	}
+
+	return inbuf[inbuf_pos++];
+}
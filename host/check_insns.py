@@ -0,0 +1,55 @@
+#!/usr/bin/python3
+#
+# Check that the host interpreter models every instruction the generator
+# can emit: enable each one on its own and make sure no test case takes
+# an illegal instruction program check. Traps are fine, tw and friends
+# are meant to take them.
+#
+# Usage: check_insns.py [simple_random [seeds]]
+
+import subprocess
+import sys
+
+SRR1_ILLEGAL = 0x80000
+
+
+def run(binary, commands):
+    p = subprocess.run([binary], input="".join(c + "\n" for c in commands),
+                       capture_output=True, text=True, check=True)
+    return p.stdout.replace("\r", "").splitlines()
+
+
+def insn_names(binary):
+    lines = run(binary, ["disable *", "enable *"])
+    return [line.split()[1] for line in lines if line.startswith("Enabling ")]
+
+
+def illegal_faults(lines):
+    for line in lines:
+        fields = line.split()
+        # seed fault type addr msr dar dsisr
+        if len(fields) == 7 and fields[1] == "fault" and \
+           int(fields[2], 16) == 0x700 and int(fields[4], 16) & SRR1_ILLEGAL:
+            yield line
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else "./simple_random"
+    seeds = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+    failed = []
+
+    for name in insn_names(binary):
+        lines = run(binary, ["disable *", "enable " + name,
+                             "test_many 0 64 %d" % seeds])
+        faults = list(illegal_faults(lines))
+        if faults:
+            print("%s: %s" % (name, faults[0]))
+            failed.append(name)
+
+    if failed:
+        print("%d instructions not modelled" % len(failed))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
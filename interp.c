@@ -0,0 +1,1188 @@
+#include <string.h>
+#include "interp.h"
+
+#define XER_SO		(1UL << 31)
+#define XER_OV		(1UL << 30)
+#define XER_CA		(1UL << 29)
+#define XER_OV32	(1UL << 19)
+#define XER_CA32	(1UL << 18)
+/* What mtxer keeps on POWER9, everything else reads back as zero */
+#define XER_MASK	0xe00fffffUL
+
+#define SPR_XER		1
+#define SPR_LR		8
+#define SPR_CTR		9
+#define SPR_TAR		815
+
+#define VEC_DSI		0x300
+#define VEC_ISI		0x400
+#define VEC_PROGRAM	0x700
+
+/* Why a program interrupt was taken */
+#define SRR1_ILLEGAL	0x80000
+#define SRR1_TRAP	0x20000
+
+/* Instruction fields */
+#define OPCD(I)		((I) >> 26)
+#define RT(I)		(((I) >> 21) & 0x1f)
+#define RS(I)		RT(I)
+#define RA(I)		(((I) >> 16) & 0x1f)
+#define RB(I)		(((I) >> 11) & 0x1f)
+#define BF(I)		(((I) >> 23) & 0x7)
+#define BFA(I)		(((I) >> 18) & 0x7)
+#define L(I)		(((I) >> 21) & 0x1)
+#define XO10(I)		(((I) >> 1) & 0x3ff)
+#define RC(I)		((I) & 1)
+#define OE(I)		(((I) >> 10) & 1)
+#define SI(I)		((int64_t)(int16_t)((I) & 0xffff))
+#define UI(I)		((uint64_t)((I) & 0xffff))
+#define DS(I)		((int64_t)(int16_t)((I) & 0xfffc))
+#define SH5(I)		(((I) >> 11) & 0x1f)
+#define MB5(I)		(((I) >> 6) & 0x1f)
+#define ME5(I)		(((I) >> 1) & 0x1f)
+#define SH6(I)		(SH5(I) | (((I) & 0x2) << 4))
+#define MB6(I)		(MB5(I) | ((I) & 0x20))
+#define FXM(I)		(((I) >> 12) & 0xff)
+
+/* Both OE forms of an XO form arithmetic op */
+#define XO(N)		case (N): case (N) | 0x200
+
+enum stop { RUN, STOP_TRAP, STOP_FAULT };
+
+static bool mem_ok(struct interp *s, uint64_t ea, unsigned long size)
+{
+	for (unsigned long i = 0; i < s->nr_regions; i++) {
+		struct interp_region *r = &s->regions[i];
+
+		if (ea >= r->start && ea - r->start + size <= r->size)
+			return true;
+	}
+
+	return false;
+}
+
+/* Guest memory is little endian, whatever the host is */
+static uint64_t load(uint64_t ea, unsigned long size)
+{
+	const uint8_t *p = (const uint8_t *)(uintptr_t)ea;
+	uint64_t val = 0;
+
+	for (unsigned long i = 0; i < size; i++)
+		val |= (uint64_t)p[i] << (i * 8);
+
+	return val;
+}
+
+static void store(uint64_t ea, unsigned long size, uint64_t val)
+{
+	uint8_t *p = (uint8_t *)(uintptr_t)ea;
+
+	for (unsigned long i = 0; i < size; i++)
+		p[i] = val >> (i * 8);
+}
+
+static uint64_t byteswap(uint64_t val, unsigned long size)
+{
+	uint64_t r = 0;
+
+	for (unsigned long i = 0; i < size; i++)
+		r |= ((val >> (i * 8)) & 0xff) << ((size - 1 - i) * 8);
+
+	return r;
+}
+
+static uint64_t rotl64(uint64_t x, unsigned long n)
+{
+	n &= 63;
+	return n ? (x << n) | (x >> (64 - n)) : x;
+}
+
+static uint64_t rotl32(uint64_t x, unsigned long n)
+{
+	x &= 0xffffffff;
+	return rotl64(x | (x << 32), n);
+}
+
+/* Bits mb to me inclusive, numbered from the MSB, wrapping if mb > me */
+static uint64_t mask64(unsigned long mb, unsigned long me)
+{
+	uint64_t m1 = ~0UL >> mb;
+	uint64_t m2 = ~0UL << (63 - me);
+
+	return (mb <= me) ? (m1 & m2) : (m1 | m2);
+}
+
+static unsigned long clz64(uint64_t x)
+{
+	return x ? __builtin_clzll(x) : 64;
+}
+
+static unsigned long ctz64(uint64_t x)
+{
+	return x ? __builtin_ctzll(x) : 64;
+}
+
+static unsigned long crbit(struct interp *s, unsigned long bi)
+{
+	return (s->cr >> (31 - bi)) & 1;
+}
+
+static void set_crbit(struct interp *s, unsigned long bi, unsigned long v)
+{
+	uint32_t m = 1U << (31 - bi);
+
+	s->cr = (s->cr & ~m) | (v ? m : 0);
+}
+
+static void set_crfield(struct interp *s, unsigned long bf, unsigned long v)
+{
+	unsigned long shift = 28 - bf * 4;
+
+	s->cr = (s->cr & ~(0xfU << shift)) | ((v & 0xf) << shift);
+}
+
+static unsigned long so(struct interp *s)
+{
+	return (s->xer & XER_SO) ? 1 : 0;
+}
+
+static unsigned long compare(struct interp *s, int64_t a, int64_t b)
+{
+	unsigned long c = (a < b) ? 8 : (a > b) ? 4 : 2;
+
+	return c | so(s);
+}
+
+static unsigned long compare_unsigned(struct interp *s, uint64_t a,
+				      uint64_t b)
+{
+	unsigned long c = (a < b) ? 8 : (a > b) ? 4 : 2;
+
+	return c | so(s);
+}
+
+static void set_cr0(struct interp *s, uint64_t val)
+{
+	set_crfield(s, 0, compare(s, val, 0));
+}
+
+static void set_ca(struct interp *s, bool ca, bool ca32)
+{
+	s->xer &= ~(XER_CA | XER_CA32);
+	if (ca)
+		s->xer |= XER_CA;
+	if (ca32)
+		s->xer |= XER_CA32;
+}
+
+static void set_ov(struct interp *s, bool ov, bool ov32)
+{
+	s->xer &= ~(XER_OV | XER_OV32);
+	if (ov)
+		s->xer |= XER_OV | XER_SO;
+	if (ov32)
+		s->xer |= XER_OV32;
+}
+
+/* a + b + c, setting CA/CA32 if carry and OV/OV32 if oe */
+static uint64_t add(struct interp *s, uint64_t a, uint64_t b, uint64_t c,
+		    bool carry, bool oe)
+{
+	uint64_t r = a + b + c;
+
+	if (carry) {
+		bool ca = (r < a) || (r == a && (b || c));
+		bool ca32 = (((a & 0xffffffff) + (b & 0xffffffff) + c) >> 32) & 1;
+
+		set_ca(s, ca, ca32);
+	}
+
+	if (oe) {
+		uint64_t v = (a ^ r) & (b ^ r);
+
+		set_ov(s, v >> 63, (v >> 31) & 1);
+	}
+
+	return r;
+}
+
+static uint64_t ca(struct interp *s)
+{
+	return (s->xer & XER_CA) ? 1 : 0;
+}
+
+/*
+ * Divides. POWER9 returns 0 for the undefined cases (divide by zero,
+ * overflow), and the 32 bit ones zero extend their result.
+ */
+static uint64_t divide(struct interp *s, uint32_t insn, unsigned long xo,
+		       uint64_t a, uint64_t b, bool *ov)
+{
+	*ov = false;
+
+	switch (xo & 0x1ff) {
+	case 489: {	/* divd */
+		int64_t x = a, y = b;
+
+		if (!y || (x == INT64_MIN && y == -1)) {
+			*ov = true;
+			return 0;
+		}
+		return x / y;
+	}
+	case 457:	/* divdu */
+		if (!b) {
+			*ov = true;
+			return 0;
+		}
+		return a / b;
+	case 425: {	/* divde */
+		__int128 x = (__int128)(int64_t)a << 64;
+		int64_t y = b;
+		__int128 q;
+
+		if (!y) {
+			*ov = true;
+			return 0;
+		}
+		q = x / y;
+		if (q > INT64_MAX || q < INT64_MIN) {
+			*ov = true;
+			return 0;
+		}
+		return q;
+	}
+	case 393: {	/* divdeu */
+		unsigned __int128 x = (unsigned __int128)a << 64;
+		unsigned __int128 q;
+
+		if (!b || a >= b) {
+			*ov = true;
+			return 0;
+		}
+		q = x / b;
+		return q;
+	}
+	case 491: {	/* divw */
+		int32_t x = a, y = b;
+
+		if (!y || (x == INT32_MIN && y == -1)) {
+			*ov = true;
+			return 0;
+		}
+		return (uint32_t)(x / y);
+	}
+	case 459:	/* divwu */
+		if (!(uint32_t)b) {
+			*ov = true;
+			return 0;
+		}
+		return (uint32_t)a / (uint32_t)b;
+	case 427: {	/* divwe */
+		int64_t x = (int64_t)(int32_t)a << 32;
+		int32_t y = b;
+		int64_t q;
+
+		/* INT64_MIN / -1 would trap on the host */
+		if (!y || (x == INT64_MIN && y == -1)) {
+			*ov = true;
+			return 0;
+		}
+		q = x / y;
+		if (q > INT32_MAX || q < INT32_MIN) {
+			*ov = true;
+			return 0;
+		}
+		return (uint32_t)q;
+	}
+	case 395: {	/* divweu */
+		uint64_t x = (uint64_t)(uint32_t)a << 32;
+		uint32_t y = b;
+
+		if (!y || (uint32_t)a >= y) {
+			*ov = true;
+			return 0;
+		}
+		return (uint32_t)(x / y);
+	}
+	}
+
+	return 0;
+}
+
+static uint64_t modulo(unsigned long xo, uint64_t a, uint64_t b)
+{
+	switch (xo) {
+	case 777: {	/* modsd */
+		int64_t x = a, y = b;
+
+		if (!y || (x == INT64_MIN && y == -1))
+			return 0;
+		return x % y;
+	}
+	case 265:	/* modud */
+		return b ? a % b : 0;
+	case 779: {	/* modsw */
+		int32_t x = a, y = b;
+
+		if (!y || (x == INT32_MIN && y == -1))
+			return 0;
+		return (int64_t)(x % y);
+	}
+	case 267:	/* moduw */
+		return (uint32_t)b ? (uint32_t)a % (uint32_t)b : 0;
+	}
+
+	return 0;
+}
+
+static bool trap(unsigned long to, int64_t a, int64_t b)
+{
+	return ((to & 0x10) && a < b) || ((to & 0x08) && a > b) ||
+	       ((to & 0x04) && a == b) ||
+	       ((to & 0x02) && (uint64_t)a < (uint64_t)b) ||
+	       ((to & 0x01) && (uint64_t)a > (uint64_t)b);
+}
+
+static bool branch_taken(struct interp *s, unsigned long bo, unsigned long bi)
+{
+	bool ctr_ok, cond_ok;
+
+	if (!(bo & 0x04))
+		s->ctr--;
+
+	ctr_ok = (bo & 0x04) || ((s->ctr != 0) ^ ((bo >> 1) & 1));
+	cond_ok = (bo & 0x10) || (crbit(s, bi) == ((bo >> 3) & 1));
+
+	return ctr_ok && cond_ok;
+}
+
+/*
+ * The CR fields an mfocrf/mtocrf or mtcrf touches (mfcr reads them all).
+ * The one field forms with FXM not one-hot are undefined, POWER9 uses the
+ * leftmost field in FXM or CR7 if FXM is 0.
+ */
+static uint32_t crmask(uint32_t insn)
+{
+	unsigned long fxm = FXM(insn);
+	uint32_t m = 0;
+
+	if (!(insn & 0x00100000)) {
+		if (XO10(insn) == 19)
+			return ~0U;
+	} else {
+		fxm = fxm ? 1UL << (31 - __builtin_clz(fxm)) : 1;
+	}
+
+	for (unsigned long i = 0; i < 8; i++)
+		if (fxm & (0x80 >> i))
+			m |= 0xf0000000U >> (i * 4);
+
+	return m;
+}
+
+static enum stop fault(struct interp *s, unsigned long type, uint64_t dar)
+{
+	s->fault_type = type;
+	s->fault_addr = s->pc;
+	s->dar = dar;
+	s->srr1 = 0;
+
+	return STOP_FAULT;
+}
+
+static enum stop illegal(struct interp *s)
+{
+	fault(s, VEC_PROGRAM, 0);
+	s->srr1 = SRR1_ILLEGAL;
+
+	return STOP_FAULT;
+}
+
+static enum stop do_load(struct interp *s, uint32_t insn, uint64_t ea,
+			 unsigned long size, bool sign, bool rev,
+			 bool update)
+{
+	uint64_t val;
+
+	if (!mem_ok(s, ea, size))
+		return fault(s, VEC_DSI, ea);
+
+	val = load(ea, size);
+	if (rev)
+		val = byteswap(val, size);
+	if (sign && size < 8) {
+		unsigned long shift = 64 - size * 8;
+
+		val = (uint64_t)((int64_t)(val << shift) >> shift);
+	}
+
+	s->gpr[RT(insn)] = val;
+	if (update)
+		s->gpr[RA(insn)] = ea;
+
+	return RUN;
+}
+
+static enum stop do_store(struct interp *s, uint32_t insn, uint64_t ea,
+			  unsigned long size, bool rev, bool update)
+{
+	uint64_t val = s->gpr[RS(insn)];
+
+	if (!mem_ok(s, ea, size))
+		return fault(s, VEC_DSI, ea);
+
+	if (rev)
+		val = byteswap(val, size);
+	store(ea, size, val);
+	if (update)
+		s->gpr[RA(insn)] = ea;
+
+	return RUN;
+}
+
+static enum stop do_larx(struct interp *s, uint32_t insn, uint64_t ea,
+			 unsigned long size)
+{
+	enum stop r = do_load(s, insn, ea, size, false, false, false);
+
+	if (r == RUN) {
+		s->resv_valid = true;
+		s->resv_addr = ea;
+	}
+
+	return r;
+}
+
+static enum stop do_stcx(struct interp *s, uint32_t insn, uint64_t ea,
+			 unsigned long size)
+{
+	unsigned long c = so(s);
+
+	if (!mem_ok(s, ea, size))
+		return fault(s, VEC_DSI, ea);
+
+	/* The reservation granule is a cache line */
+	if (s->resv_valid && (s->resv_addr >> 7) == (ea >> 7)) {
+		store(ea, size, s->gpr[RS(insn)]);
+		c |= 2;
+	}
+
+	s->resv_valid = false;
+	set_crfield(s, 0, c);
+
+	return RUN;
+}
+
+static enum stop op31(struct interp *s, uint32_t insn)
+{
+	uint64_t *gpr = s->gpr;
+	uint64_t ra = RA(insn) ? gpr[RA(insn)] : 0;
+	uint64_t a = gpr[RA(insn)];
+	uint64_t b = gpr[RB(insn)];
+	uint64_t rs = gpr[RS(insn)];
+	uint64_t ea = ra + b;
+	unsigned long xo = XO10(insn);
+	bool oe = OE(insn);
+	uint64_t r;
+
+	/* isel is A form */
+	if ((xo & 0x1f) == 15) {
+		gpr[RT(insn)] = crbit(s, (insn >> 6) & 0x1f) ? ra : b;
+		return RUN;
+	}
+
+	switch (xo) {
+	/* Arithmetic, result in RT */
+	XO(266):	/* add */
+		r = add(s, a, b, 0, false, oe);
+		break;
+	XO(40):		/* subf */
+		r = add(s, ~a, b, 1, false, oe);
+		break;
+	XO(104):	/* neg */
+		r = add(s, ~a, 0, 1, false, oe);
+		break;
+	XO(10):		/* addc */
+		r = add(s, a, b, 0, true, oe);
+		break;
+	XO(138):	/* adde */
+		r = add(s, a, b, ca(s), true, oe);
+		break;
+	XO(202):	/* addze */
+		r = add(s, a, 0, ca(s), true, oe);
+		break;
+	XO(234):	/* addme */
+		r = add(s, a, ~0UL, ca(s), true, oe);
+		break;
+	XO(8):		/* subfc */
+		r = add(s, ~a, b, 1, true, oe);
+		break;
+	XO(136):	/* subfe */
+		r = add(s, ~a, b, ca(s), true, oe);
+		break;
+	XO(232):	/* subfme */
+		r = add(s, ~a, ~0UL, ca(s), true, oe);
+		break;
+	XO(200):	/* subfze */
+		r = add(s, ~a, 0, ca(s), true, oe);
+		break;
+
+	/* Only CY = 0 is defined, carrying through OV. Rc is ignored */
+	case 170: {	/* addex */
+		uint64_t c = (s->xer & XER_OV) ? 1 : 0;
+		bool ov32 = (((a & 0xffffffff) + (b & 0xffffffff) + c) >> 32) & 1;
+
+		r = a + b + c;
+		s->xer &= ~(XER_OV | XER_OV32);
+		if ((r < a) || (r == a && (b || c)))
+			s->xer |= XER_OV;
+		if (ov32)
+			s->xer |= XER_OV32;
+		gpr[RT(insn)] = r;
+		return RUN;
+	}
+
+	/* OE is reserved for these, and ignored */
+	XO(73):		/* mulhd */
+		r = ((__int128)(int64_t)a * (int64_t)b) >> 64;
+		break;
+	XO(9):		/* mulhdu */
+		r = ((unsigned __int128)a * b) >> 64;
+		break;
+	/* POWER9 puts the high word in both halves */
+	XO(75): {	/* mulhw */
+		uint64_t h = (uint64_t)((int64_t)(int32_t)a * (int32_t)b) >> 32;
+
+		r = (h & 0xffffffff) | (h << 32);
+		break;
+	}
+	XO(11): {	/* mulhwu */
+		uint64_t h = ((uint64_t)(uint32_t)a * (uint32_t)b) >> 32;
+
+		r = h | (h << 32);
+		break;
+	}
+
+	XO(233): {	/* mulld */
+		__int128 p = (__int128)(int64_t)a * (int64_t)b;
+
+		r = p;
+		if (oe) {
+			bool ov = p != (int64_t)r;
+
+			set_ov(s, ov, ov);
+		}
+		break;
+	}
+	XO(235): {	/* mullw */
+		int64_t p = (int64_t)(int32_t)a * (int32_t)b;
+
+		r = p;
+		if (oe) {
+			bool ov = p != (int32_t)p;
+
+			set_ov(s, ov, ov);
+		}
+		break;
+	}
+
+	XO(489): XO(457): XO(425): XO(393):
+	XO(491): XO(459): XO(427): XO(395): {
+		bool ov;
+
+		r = divide(s, insn, xo, a, b, &ov);
+		if (oe)
+			set_ov(s, ov, ov);
+		break;
+	}
+
+	case 777: case 265: case 779: case 267:
+		gpr[RT(insn)] = modulo(xo, a, b);
+		return RUN;
+
+	/* Logical, result in RA */
+	case 28:	/* and */
+		r = rs & b;
+		goto logical;
+	case 316:	/* xor */
+		r = rs ^ b;
+		goto logical;
+	case 476:	/* nand */
+		r = ~(rs & b);
+		goto logical;
+	case 444:	/* or */
+		r = rs | b;
+		goto logical;
+	case 124:	/* nor */
+		r = ~(rs | b);
+		goto logical;
+	case 60:	/* andc */
+		r = rs & ~b;
+		goto logical;
+	case 284:	/* eqv */
+		r = ~(rs ^ b);
+		goto logical;
+	case 412:	/* orc */
+		r = rs | ~b;
+		goto logical;
+	case 954:	/* extsb */
+		r = (int64_t)(int8_t)rs;
+		goto logical;
+	case 922:	/* extsh */
+		r = (int64_t)(int16_t)rs;
+		goto logical;
+	case 986:	/* extsw */
+		r = (int64_t)(int32_t)rs;
+		goto logical;
+	case 890: case 891:	/* extswsli */
+		r = (uint64_t)(int64_t)(int32_t)rs << SH6(insn);
+		goto logical;
+	case 26:	/* cntlzw */
+		r = clz64(rs & 0xffffffff) - 32;
+		goto logical;
+	case 538:	/* cnttzw */
+		r = (rs & 0xffffffff) ? ctz64(rs) : 32;
+		goto logical;
+	case 58:	/* cntlzd */
+		r = clz64(rs);
+		goto logical;
+	case 570:	/* cnttzd */
+		r = ctz64(rs);
+		goto logical;
+	case 24: {	/* slw */
+		unsigned long n = b & 0x3f;
+
+		r = (n & 0x20) ? 0 : (rs << n) & 0xffffffff;
+		goto logical;
+	}
+	case 536: {	/* srw */
+		unsigned long n = b & 0x3f;
+
+		r = (n & 0x20) ? 0 : (rs & 0xffffffff) >> n;
+		goto logical;
+	}
+	case 27: {	/* sld */
+		unsigned long n = b & 0x7f;
+
+		r = (n & 0x40) ? 0 : rs << n;
+		goto logical;
+	}
+	case 539: {	/* srd */
+		unsigned long n = b & 0x7f;
+
+		r = (n & 0x40) ? 0 : rs >> n;
+		goto logical;
+	}
+	case 792: case 824: {	/* sraw, srawi */
+		unsigned long n = (xo == 824) ? SH5(insn) : (b & 0x3f);
+		int64_t x = (int32_t)rs;
+		bool c;
+
+		if (n & 0x20) {
+			r = x < 0 ? ~0UL : 0;
+			c = x < 0;
+		} else {
+			r = x >> n;
+			c = x < 0 && (x & ((1UL << n) - 1));
+		}
+		set_ca(s, c, c);
+		goto logical;
+	}
+	case 794: case 826: case 827: {	/* srad, sradi */
+		unsigned long n = (xo == 794) ? (b & 0x7f) : SH6(insn);
+		int64_t x = rs;
+		bool c;
+
+		if (n & 0x40) {
+			r = x < 0 ? ~0UL : 0;
+			c = x < 0;
+		} else {
+			r = x >> n;
+			c = x < 0 && n && (x & ((1UL << n) - 1));
+		}
+		set_ca(s, c, c);
+		goto logical;
+	}
+	/* Rc is reserved for these, POWER9 ignores it */
+	case 122:	/* popcntb */
+		r = 0;
+		for (unsigned long i = 0; i < 64; i += 8)
+			r |= (uint64_t)__builtin_popcountll((rs >> i) & 0xff) << i;
+		goto no_rc;
+	case 378:	/* popcntw */
+		r = __builtin_popcountll(rs & 0xffffffff) |
+		    ((uint64_t)__builtin_popcountll(rs >> 32) << 32);
+		goto no_rc;
+	case 506:	/* popcntd */
+		r = __builtin_popcountll(rs);
+		goto no_rc;
+	case 186:	/* prtyd */
+		r = __builtin_parityll(rs & 0x0101010101010101UL);
+		goto no_rc;
+	case 154:	/* prtyw */
+		r = __builtin_parityll(rs & 0x01010101UL) |
+		    ((uint64_t)__builtin_parityll(rs & 0x0101010100000000UL) << 32);
+		goto no_rc;
+	case 508:	/* cmpb */
+		r = 0;
+		for (unsigned long i = 0; i < 64; i += 8)
+			if (((rs >> i) & 0xff) == ((b >> i) & 0xff))
+				r |= 0xffUL << i;
+		goto no_rc;
+	case 252:	/* bpermd */
+		r = 0;
+		for (unsigned long i = 0; i < 8; i++) {
+			unsigned long idx = (rs >> (i * 8)) & 0xff;
+
+			if (idx < 64 && ((b >> (63 - idx)) & 1))
+				r |= 1UL << i;
+		}
+		goto no_rc;
+
+	case 0:		/* cmp */
+		if (L(insn))
+			set_crfield(s, BF(insn), compare(s, a, b));
+		else
+			set_crfield(s, BF(insn),
+				    compare(s, (int32_t)a, (int32_t)b));
+		return RUN;
+	case 32:	/* cmpl */
+		if (L(insn))
+			set_crfield(s, BF(insn), compare_unsigned(s, a, b));
+		else
+			set_crfield(s, BF(insn), compare_unsigned(s,
+				    (uint32_t)a, (uint32_t)b));
+		return RUN;
+	case 192: {	/* cmprb */
+		unsigned long c = a & 0xff;
+		bool in = c >= (b & 0xff) && c <= ((b >> 8) & 0xff);
+
+		if (L(insn))
+			in |= c >= ((b >> 16) & 0xff) && c <= ((b >> 24) & 0xff);
+		set_crfield(s, BF(insn), in ? 4 : 0);
+		return RUN;
+	}
+	case 224: {	/* cmpeqb */
+		bool in = false;
+
+		for (unsigned long i = 0; i < 64; i += 8)
+			if (((b >> i) & 0xff) == (a & 0xff))
+				in = true;
+		set_crfield(s, BF(insn), in ? 4 : 0);
+		return RUN;
+	}
+	case 128:	/* setb */
+		if (crbit(s, BFA(insn) * 4))
+			gpr[RT(insn)] = -1UL;
+		else if (crbit(s, BFA(insn) * 4 + 1))
+			gpr[RT(insn)] = 1;
+		else
+			gpr[RT(insn)] = 0;
+		return RUN;
+
+	case 19:	/* mfcr, mfocrf */
+		gpr[RT(insn)] = s->cr & crmask(insn);
+		return RUN;
+	case 144: {	/* mtcrf, mtocrf */
+		uint32_t m = crmask(insn);
+
+		s->cr = (s->cr & ~m) | (rs & m);
+		return RUN;
+	}
+
+	case 339:	/* mfspr */
+	case 467: {	/* mtspr */
+		unsigned long spr = RA(insn) | (RB(insn) << 5);
+		uint64_t *p;
+
+		switch (spr) {
+		case SPR_XER:
+			p = &s->xer;
+			break;
+		case SPR_LR:
+			p = &s->lr;
+			break;
+		case SPR_CTR:
+			p = &s->ctr;
+			break;
+		case SPR_TAR:
+			p = &s->tar;
+			break;
+		default:
+			return illegal(s);
+		}
+
+		if (xo == 339)
+			gpr[RT(insn)] = *p;
+		else
+			*p = (spr == SPR_XER) ? (rs & XER_MASK) : rs;
+		return RUN;
+	}
+
+	case 4:		/* tw */
+		if (trap(RT(insn), (int32_t)a, (int32_t)b))
+			return STOP_TRAP;
+		return RUN;
+	case 68:	/* td */
+		if (trap(RT(insn), a, b))
+			return STOP_TRAP;
+		return RUN;
+
+	case 22:	/* icbt */
+	case 982:	/* icbi */
+	case 598:	/* sync */
+		return RUN;
+
+	/* Loads and stores */
+	case 87:	return do_load(s, insn, ea, 1, false, false, false);
+	case 119:	return do_load(s, insn, a + b, 1, false, false, true);
+	case 279:	return do_load(s, insn, ea, 2, false, false, false);
+	case 311:	return do_load(s, insn, a + b, 2, false, false, true);
+	case 343:	return do_load(s, insn, ea, 2, true, false, false);
+	case 375:	return do_load(s, insn, a + b, 2, true, false, true);
+	case 23:	return do_load(s, insn, ea, 4, false, false, false);
+	case 55:	return do_load(s, insn, a + b, 4, false, false, true);
+	case 341:	return do_load(s, insn, ea, 4, true, false, false);
+	case 373:	return do_load(s, insn, a + b, 4, true, false, true);
+	case 21:	return do_load(s, insn, ea, 8, false, false, false);
+	case 53:	return do_load(s, insn, a + b, 8, false, false, true);
+	case 790:	return do_load(s, insn, ea, 2, false, true, false);
+	case 534:	return do_load(s, insn, ea, 4, false, true, false);
+	case 532:	return do_load(s, insn, ea, 8, false, true, false);
+	case 215:	return do_store(s, insn, ea, 1, false, false);
+	case 247:	return do_store(s, insn, a + b, 1, false, true);
+	case 407:	return do_store(s, insn, ea, 2, false, false);
+	case 439:	return do_store(s, insn, a + b, 2, false, true);
+	case 151:	return do_store(s, insn, ea, 4, false, false);
+	case 183:	return do_store(s, insn, a + b, 4, false, true);
+	case 149:	return do_store(s, insn, ea, 8, false, false);
+	case 181:	return do_store(s, insn, a + b, 8, false, true);
+	case 918:	return do_store(s, insn, ea, 2, true, false);
+	case 662:	return do_store(s, insn, ea, 4, true, false);
+	case 660:	return do_store(s, insn, ea, 8, true, false);
+	case 52:	return do_larx(s, insn, ea, 1);
+	case 116:	return do_larx(s, insn, ea, 2);
+	case 20:	return do_larx(s, insn, ea, 4);
+	case 84:	return do_larx(s, insn, ea, 8);
+	case 694:	return do_stcx(s, insn, ea, 1);
+	case 726:	return do_stcx(s, insn, ea, 2);
+	case 150:	return do_stcx(s, insn, ea, 4);
+	case 214:	return do_stcx(s, insn, ea, 8);
+
+	default:
+		return illegal(s);
+	}
+
+	gpr[RT(insn)] = r;
+	if (RC(insn))
+		set_cr0(s, r);
+	return RUN;
+
+logical:
+	if (RC(insn))
+		set_cr0(s, r);
+no_rc:
+	gpr[RA(insn)] = r;
+	return RUN;
+}
+
+/* VA form multiply-adds, RC is the addend */
+static enum stop op4(struct interp *s, uint32_t insn)
+{
+	uint64_t a = s->gpr[RA(insn)];
+	uint64_t b = s->gpr[RB(insn)];
+	uint64_t c = s->gpr[(insn >> 6) & 0x1f];
+	uint64_t r;
+
+	switch (insn & 0x3f) {
+	case 48:	/* maddhd */
+		r = ((__int128)(int64_t)a * (int64_t)b + (int64_t)c) >> 64;
+		break;
+	case 49:	/* maddhdu */
+		r = ((unsigned __int128)a * b + c) >> 64;
+		break;
+	case 51:	/* maddld */
+		r = a * b + c;
+		break;
+	default:
+		return illegal(s);
+	}
+
+	s->gpr[RT(insn)] = r;
+
+	return RUN;
+}
+
+static enum stop op30(struct interp *s, uint32_t insn)
+{
+	uint64_t rs = s->gpr[RS(insn)];
+	unsigned long mb = MB6(insn);
+	uint64_t r, m;
+
+	switch ((insn >> 1) & 0xf) {
+	case 0: case 1:		/* rldicl */
+		r = rotl64(rs, SH6(insn)) & mask64(mb, 63);
+		break;
+	case 2: case 3:		/* rldicr */
+		r = rotl64(rs, SH6(insn)) & mask64(0, mb);
+		break;
+	case 4: case 5:		/* rldic */
+		r = rotl64(rs, SH6(insn)) & mask64(mb, 63 - SH6(insn));
+		break;
+	case 6: case 7:		/* rldimi */
+		m = mask64(mb, 63 - SH6(insn));
+		r = (rotl64(rs, SH6(insn)) & m) | (s->gpr[RA(insn)] & ~m);
+		break;
+	case 8:			/* rldcl */
+		r = rotl64(rs, s->gpr[RB(insn)] & 0x3f) & mask64(mb, 63);
+		break;
+	case 9:			/* rldcr */
+		r = rotl64(rs, s->gpr[RB(insn)] & 0x3f) & mask64(0, mb);
+		break;
+	default:
+		return illegal(s);
+	}
+
+	s->gpr[RA(insn)] = r;
+	if (RC(insn))
+		set_cr0(s, r);
+
+	return RUN;
+}
+
+static enum stop op19(struct interp *s, uint32_t insn, uint64_t *nia)
+{
+	unsigned long bt = RT(insn), ba = RA(insn), bb = RB(insn);
+	unsigned long x = crbit(s, ba), y = crbit(s, bb);
+
+	switch (XO10(insn)) {
+	case 0:		/* mcrf */
+		set_crfield(s, BF(insn), s->cr >> (28 - BFA(insn) * 4));
+		break;
+	case 150:	/* isync */
+		break;
+	case 16:	/* bclr */
+	case 528:	/* bcctr */
+	case 560: {	/* bctar */
+		unsigned long xo = XO10(insn);
+		uint64_t target = (xo == 16) ? s->lr :
+				  (xo == 528) ? s->ctr : s->tar;
+
+		if (branch_taken(s, RT(insn), ba))
+			*nia = target & ~3UL;
+		if (RC(insn))
+			s->lr = s->pc + 4;
+		break;
+	}
+	case 257:	set_crbit(s, bt, x & y); break;		/* crand */
+	case 129:	set_crbit(s, bt, x & !y); break;	/* crandc */
+	case 289:	set_crbit(s, bt, x == y); break;	/* creqv */
+	case 225:	set_crbit(s, bt, !(x & y)); break;	/* crnand */
+	case 33:	set_crbit(s, bt, !(x | y)); break;	/* crnor */
+	case 449:	set_crbit(s, bt, x | y); break;		/* cror */
+	case 417:	set_crbit(s, bt, x | !y); break;	/* crorc */
+	case 193:	set_crbit(s, bt, x ^ y); break;		/* crxor */
+	default:
+		return illegal(s);
+	}
+
+	return RUN;
+}
+
+static enum stop step(struct interp *s, uint32_t insn, uint64_t *nia)
+{
+	uint64_t *gpr = s->gpr;
+	uint64_t ra = RA(insn) ? gpr[RA(insn)] : 0;
+	uint64_t a = gpr[RA(insn)];
+	uint64_t rs = gpr[RS(insn)];
+	uint64_t d = ra + SI(insn);
+	uint64_t du = a + SI(insn);
+	uint64_t r;
+
+	switch (OPCD(insn)) {
+	case 2:		/* tdi */
+		return trap(RT(insn), a, SI(insn)) ? STOP_TRAP : RUN;
+	case 3:		/* twi */
+		return trap(RT(insn), (int32_t)a, SI(insn)) ? STOP_TRAP : RUN;
+	case 4:
+		return op4(s, insn);
+	case 7:		/* mulli */
+		gpr[RT(insn)] = (int64_t)a * SI(insn);
+		return RUN;
+	case 8:		/* subfic */
+		gpr[RT(insn)] = add(s, ~a, SI(insn), 1, true, false);
+		return RUN;
+	case 10:	/* cmpli */
+		if (L(insn))
+			set_crfield(s, BF(insn), compare_unsigned(s, a, UI(insn)));
+		else
+			set_crfield(s, BF(insn),
+				    compare_unsigned(s, (uint32_t)a, UI(insn)));
+		return RUN;
+	case 11:	/* cmpi */
+		if (L(insn))
+			set_crfield(s, BF(insn), compare(s, a, SI(insn)));
+		else
+			set_crfield(s, BF(insn),
+				    compare(s, (int32_t)a, SI(insn)));
+		return RUN;
+	case 12:	/* addic */
+	case 13:	/* addic. */
+		r = add(s, a, SI(insn), 0, true, false);
+		gpr[RT(insn)] = r;
+		if (OPCD(insn) == 13)
+			set_cr0(s, r);
+		return RUN;
+	case 14:	/* addi */
+		gpr[RT(insn)] = d;
+		return RUN;
+	case 15:	/* addis */
+		gpr[RT(insn)] = ra + (SI(insn) << 16);
+		return RUN;
+	case 16: {	/* bc */
+		int64_t bd = (int16_t)(insn & 0xfffc);
+		uint64_t target = (insn & 2) ? bd : s->pc + bd;
+
+		if (branch_taken(s, RT(insn), RA(insn)))
+			*nia = target;
+		if (insn & 1)
+			s->lr = s->pc + 4;
+		return RUN;
+	}
+	case 18: {	/* b */
+		int64_t li = ((int32_t)(insn << 6)) >> 6;
+
+		*nia = ((insn & 2) ? 0 : s->pc) + (li & ~3L);
+		if (insn & 1)
+			s->lr = s->pc + 4;
+		return RUN;
+	}
+	case 19:
+		return op19(s, insn, nia);
+	case 20: {	/* rlwimi */
+		uint64_t m = mask64(MB5(insn) + 32, ME5(insn) + 32);
+
+		r = (rotl32(rs, SH5(insn)) & m) | (a & ~m);
+		goto logical;
+	}
+	case 21:	/* rlwinm */
+		r = rotl32(rs, SH5(insn)) &
+		    mask64(MB5(insn) + 32, ME5(insn) + 32);
+		goto logical;
+	case 23:	/* rlwnm */
+		r = rotl32(rs, gpr[RB(insn)] & 0x1f) &
+		    mask64(MB5(insn) + 32, ME5(insn) + 32);
+		goto logical;
+	case 24:	/* ori */
+		gpr[RA(insn)] = rs | UI(insn);
+		return RUN;
+	case 25:	/* oris */
+		gpr[RA(insn)] = rs | (UI(insn) << 16);
+		return RUN;
+	case 26:	/* xori */
+		gpr[RA(insn)] = rs ^ UI(insn);
+		return RUN;
+	case 27:	/* xoris */
+		gpr[RA(insn)] = rs ^ (UI(insn) << 16);
+		return RUN;
+	case 28:	/* andi. */
+		r = rs & UI(insn);
+		gpr[RA(insn)] = r;
+		set_cr0(s, r);
+		return RUN;
+	case 29:	/* andis. */
+		r = rs & (UI(insn) << 16);
+		gpr[RA(insn)] = r;
+		set_cr0(s, r);
+		return RUN;
+	case 30:
+		return op30(s, insn);
+	case 31:
+		return op31(s, insn);
+	case 32:	return do_load(s, insn, d, 4, false, false, false);
+	case 33:	return do_load(s, insn, du, 4, false, false, true);
+	case 34:	return do_load(s, insn, d, 1, false, false, false);
+	case 35:	return do_load(s, insn, du, 1, false, false, true);
+	case 36:	return do_store(s, insn, d, 4, false, false);
+	case 37:	return do_store(s, insn, du, 4, false, true);
+	case 38:	return do_store(s, insn, d, 1, false, false);
+	case 39:	return do_store(s, insn, du, 1, false, true);
+	case 40:	return do_load(s, insn, d, 2, false, false, false);
+	case 41:	return do_load(s, insn, du, 2, false, false, true);
+	case 42:	return do_load(s, insn, d, 2, true, false, false);
+	case 43:	return do_load(s, insn, du, 2, true, false, true);
+	case 44:	return do_store(s, insn, d, 2, false, false);
+	case 45:	return do_store(s, insn, du, 2, false, true);
+	case 58:
+		switch (insn & 3) {
+		case 0:	return do_load(s, insn, ra + DS(insn), 8, false, false, false);
+		case 1:	return do_load(s, insn, a + DS(insn), 8, false, false, true);
+		case 2:	return do_load(s, insn, ra + DS(insn), 4, true, false, false);
+		}
+		break;
+	case 62:
+		switch (insn & 3) {
+		case 0:	return do_store(s, insn, ra + DS(insn), 8, false, false);
+		case 1:	return do_store(s, insn, a + DS(insn), 8, false, true);
+		}
+		break;
+	}
+
+	return illegal(s);
+
+logical:
+	gpr[RA(insn)] = r;
+	if (RC(insn))
+		set_cr0(s, r);
+	return RUN;
+}
+
+void interp_init(struct interp *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+void interp_add_region(struct interp *s, void *start, uint64_t size)
+{
+	if (s->nr_regions < INTERP_MAX_REGIONS) {
+		s->regions[s->nr_regions].start = (uintptr_t)start;
+		s->regions[s->nr_regions].size = size;
+		s->nr_regions++;
+	}
+}
+
+/*
+ * Run from s->pc until we branch to ret_addr, trap or fault, or give up
+ * after max_steps instructions (0 = no limit).
+ */
+enum interp_stop interp_run(struct interp *s, uint64_t ret_addr,
+			    unsigned long max_steps)
+{
+	for (unsigned long n = 0; !max_steps || n < max_steps; n++) {
+		uint64_t nia = s->pc + 4;
+		enum stop r;
+
+		if (s->pc == ret_addr)
+			return INTERP_RETURN;
+
+		if ((s->pc & 3) || !mem_ok(s, s->pc, 4)) {
+			fault(s, VEC_ISI, s->pc);
+			return INTERP_FAULT;
+		}
+
+		r = step(s, load(s->pc, 4), &nia);
+		if (r == STOP_TRAP) {
+			/* Left for the caller to decide if it was expected */
+			fault(s, VEC_PROGRAM, 0);
+			s->srr1 = SRR1_TRAP;
+			return INTERP_TRAP;
+		}
+		if (r == STOP_FAULT)
+			return INTERP_FAULT;
+
+		s->pc = nia;
+	}
+
+	return INTERP_TIMEOUT;
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A functional model of the instructions simple_random generates, plus
+ * what the prolog and epilog use, for hosts that aren't POWER. Guest
+ * addresses are host addresses, but only the regions handed to the
+ * interpreter can be touched.
+ */
+#define INTERP_MAX_REGIONS	4
+
+struct interp_region {
+	uint64_t start;
+	uint64_t size;
+};
+
+struct interp {
+	uint64_t gpr[32];
+	uint32_t cr;
+	uint64_t lr;
+	uint64_t ctr;
+	uint64_t xer;
+	uint64_t tar;
+	uint64_t pc;
+
+	bool resv_valid;
+	uint64_t resv_addr;
+
+	struct interp_region regions[INTERP_MAX_REGIONS];
+	unsigned long nr_regions;
+
+	/*
+	 * Set when interp_run returns INTERP_FAULT or INTERP_TRAP, vectors
+	 * and SRR1 reason bits as on Microwatt
+	 */
+	unsigned long fault_type;
+	uint64_t fault_addr;
+	uint64_t dar;
+	uint64_t srr1;
+};
+
+enum interp_stop {
+	INTERP_RETURN,		/* branched to ret_addr */
+	INTERP_TRAP,		/* hit a trap, s->pc points at it */
+	INTERP_FAULT,
+	INTERP_TIMEOUT,
+};
+
+void interp_init(struct interp *s);
+void interp_add_region(struct interp *s, void *start, uint64_t size);
+enum interp_stop interp_run(struct interp *s, uint64_t ret_addr,
+			    unsigned long max_steps);
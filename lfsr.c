@@ -3,6 +3,8 @@
  * From:
  * https://en.wikipedia.org/wiki/Linear-feedback_shift_register
  */
+#include "lfsr.h"
+
 const unsigned long lfsr_taps[] = {
 	0,
 	0,
@@ -71,3 +73,64 @@ const unsigned long lfsr_taps[] = {
 	(1UL << (63-1)) | (1UL << (62-1)),
 #endif
 };
+
+/*
+ * The feedback for the next 8 steps only depends on the bottom 8 bits of
+ * the state, and the rest just shifts down. Precompute what each bottom
+ * byte turns into so we can advance a byte at a time.
+ */
+void lfsr_init_table(struct lfsr_table *t, unsigned long bits)
+{
+	t->bits = bits;
+
+	for (unsigned long b = 0; b < 256; b++) {
+		unsigned long v = b;
+
+		for (unsigned long i = 0; i < 8; i++)
+			v = mylfsr(bits, v);
+
+		t->step8[b] = v;
+	}
+}
+
+static unsigned long apply(const unsigned long *m, unsigned long bits,
+			   unsigned long v)
+{
+	unsigned long r = 0;
+
+	for (unsigned long j = 0; j < bits; j++)
+		r ^= m[j] & -((v >> j) & 1);
+
+	return r;
+}
+
+/*
+ * Advance the LFSR n steps. A step is linear over GF(2), so keep the
+ * matrix for 2^k steps (column j is where bit j ends up) and square it
+ * for each bit of n.
+ */
+unsigned long lfsr_jump(unsigned long bits, unsigned long state,
+			unsigned long n)
+{
+	unsigned long m[sizeof(unsigned long) * 8];
+	unsigned long tmp[sizeof(unsigned long) * 8];
+
+	for (unsigned long j = 0; j < bits; j++)
+		m[j] = mylfsr(bits, 1UL << j);
+
+	while (n) {
+		if (n & 1)
+			state = apply(m, bits, state);
+
+		n >>= 1;
+		if (!n)
+			break;
+
+		for (unsigned long j = 0; j < bits; j++)
+			tmp[j] = apply(m, bits, m[j]);
+		for (unsigned long j = 0; j < bits; j++)
+			m[j] = tmp[j];
+	}
+
+	return state;
+}
@@ -1,4 +1,4 @@
-extern unsigned long lfsr_taps[];
+extern const unsigned long lfsr_taps[];
 
 static inline unsigned long __mylfsr(unsigned long lfsr_tap, unsigned long prev)
 {
@@ -21,3 +21,33 @@ static inline unsigned long mylfsr(unsigned long bits, unsigned long prev)
 }
 
 unsigned long mylfsr(unsigned long bits, unsigned long prev);
+
+/* Byte at a time stepping, see lfsr_init_table */
+struct lfsr_table {
+	unsigned long bits;
+	unsigned long step8[256];
+};
+
+void lfsr_init_table(struct lfsr_table *t, unsigned long bits);
+
+static inline unsigned long lfsr_step8(const struct lfsr_table *t,
+				       unsigned long prev)
+{
+	return (prev >> 8) ^ t->step8[prev & 0xff];
+}
+
+static inline unsigned long lfsr_step16(const struct lfsr_table *t,
+					unsigned long prev)
+{
+	return lfsr_step8(t, lfsr_step8(t, prev));
+}
+
+static inline unsigned long lfsr_step32(const struct lfsr_table *t,
+					unsigned long prev)
+{
+	return lfsr_step16(t, lfsr_step16(t, prev));
+}
+
+/* Advance n steps in O(log n) */
+unsigned long lfsr_jump(unsigned long bits, unsigned long state,
+			unsigned long n);
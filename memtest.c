@@ -0,0 +1,329 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#if __STDC_HOSTED__ == 1
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+#include "backend.h"
+#include "lfsr.h"
+#include "memtest.h"
+#include "mystdio.h"
+
+/* Don't flood the console when a whole DIMM is bad */
+#define MAX_REPORTED	8
+
+#define MI_PATTERN	0x0UL
+
+struct slice {
+	unsigned long *start;
+	unsigned long *end;
+	unsigned long first;	/* index of start in the whole region */
+	unsigned long errors;
+};
+
+static struct lfsr_table memtest_table;
+
+static void bad_word(struct slice *s, unsigned long *p, unsigned long expected,
+		     unsigned long got)
+{
+	if (s->errors++ >= MAX_REPORTED)
+		return;
+
+	print("Bad data at ");
+	puthex((unsigned long)p);
+	print(" expected ");
+	puthex(expected);
+	print(" got ");
+	puthex(got);
+	print("\r\n");
+}
+
+static inline void check(struct slice *s, unsigned long *p,
+			 unsigned long expected)
+{
+	unsigned long got = *p;
+
+	if (got != expected)
+		bad_word(s, p, expected, got);
+}
+
+/* A write pass and a check pass for a pattern that is a function of w or p */
+#define WRITE_CHECK(NAME, VAL)						\
+static void NAME##_write(struct slice *s)				\
+{									\
+	unsigned long w = s->first;					\
+									\
+	for (unsigned long *p = s->start; p < s->end; p++, w++)		\
+		*p = (VAL);						\
+}									\
+									\
+static void NAME##_check(struct slice *s)				\
+{									\
+	unsigned long w = s->first;					\
+									\
+	for (unsigned long *p = s->start; p < s->end; p++, w++)		\
+		check(s, p, (VAL));					\
+}
+
+WRITE_CHECK(walking_ones, 1UL << (w % 64))
+WRITE_CHECK(walking_zeros, ~(1UL << (w % 64)))
+WRITE_CHECK(address, (unsigned long)p)
+WRITE_CHECK(mi, MI_PATTERN)
+
+/*
+ * Moving inversions: flip every word going up, then flip it back going
+ * down, checking the old value each time.
+ */
+static void mi_up(struct slice *s)
+{
+	for (unsigned long *p = s->start; p < s->end; p++) {
+		check(s, p, MI_PATTERN);
+		*p = ~MI_PATTERN;
+	}
+}
+
+static void mi_down(struct slice *s)
+{
+	for (unsigned long *p = s->end; p-- > s->start; ) {
+		check(s, p, ~MI_PATTERN);
+		*p = MI_PATTERN;
+	}
+}
+
+/*
+ * Each word takes 64 steps of the LFSR, so a slice can jump straight to
+ * its own part of the sequence and workers don't need to share state.
+ */
+static unsigned long lfsr_start(struct slice *s)
+{
+	return lfsr_jump(32, 1, s->first * 64);
+}
+
+static inline unsigned long lfsr_next(unsigned long *lfsr)
+{
+	unsigned long val;
+
+	*lfsr = lfsr_step32(&memtest_table, *lfsr);
+	val = *lfsr;
+	*lfsr = lfsr_step32(&memtest_table, *lfsr);
+	val |= *lfsr << 32;
+
+	return val;
+}
+
+static void lfsr_write(struct slice *s)
+{
+	unsigned long lfsr = lfsr_start(s);
+
+	for (unsigned long *p = s->start; p < s->end; p++)
+		*p = lfsr_next(&lfsr);
+}
+
+static void lfsr_check(struct slice *s)
+{
+	unsigned long lfsr = lfsr_start(s);
+
+	for (unsigned long *p = s->start; p < s->end; p++)
+		check(s, p, lfsr_next(&lfsr));
+}
+
+static const struct pass {
+	const char *pattern;
+	const char *phase;
+	unsigned long accesses;		/* per word */
+	void (*fn)(struct slice *s);
+} passes[] = {
+	{ "walking-ones",  "write", 1, walking_ones_write },
+	{ "walking-ones",  "check", 1, walking_ones_check },
+	{ "walking-zeros", "write", 1, walking_zeros_write },
+	{ "walking-zeros", "check", 1, walking_zeros_check },
+	{ "moving-inv",    "write", 1, mi_write },
+	{ "moving-inv",    "up",    2, mi_up },
+	{ "moving-inv",    "down",  2, mi_down },
+	{ "moving-inv",    "check", 1, mi_check },
+	{ "address",       "write", 1, address_write },
+	{ "address",       "check", 1, address_check },
+	{ "lfsr",          "write", 1, lfsr_write },
+	{ "lfsr",          "check", 1, lfsr_check },
+};
+
+#define NR_PASSES (sizeof(passes) / sizeof(passes[0]))
+
+static void run_slice(const struct pass *pass, unsigned long *start,
+		      unsigned long nr_words, unsigned long i,
+		      unsigned long workers, unsigned long *errors)
+{
+	unsigned long first = nr_words * i / workers;
+	struct slice s = {
+		.start = start + first,
+		.end = start + nr_words * (i + 1) / workers,
+		.first = first,
+	};
+
+	pass->fn(&s);
+	*errors = s.errors;
+}
+
+#if __STDC_HOSTED__ == 1
+/*
+ * Every worker is a forked process that regenerates and tests its own
+ * slice, so the region has to be MAP_SHARED for one pass to see what the
+ * previous one wrote.
+ */
+static unsigned long run_pass_parallel(const struct pass *pass,
+				       unsigned long *start,
+				       unsigned long nr_words,
+				       unsigned long workers)
+{
+	unsigned long *errors;
+	unsigned long total = 0;
+	int status;
+
+	errors = mmap(NULL, workers * sizeof(unsigned long),
+		      PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (errors == MAP_FAILED) {
+		run_slice(pass, start, nr_words, 0, 1, &total);
+		return total;
+	}
+
+	/* Don't let the children inherit unflushed output */
+	flush_output();
+	fflush(stdout);
+
+	for (unsigned long i = 0; i < workers; i++) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			run_slice(pass, start, nr_words, i, workers,
+				  &errors[i]);
+			flush_output();
+			fflush(stdout);
+			_exit(0);
+		}
+
+		/* Do it ourselves */
+		if (pid < 0)
+			run_slice(pass, start, nr_words, i, workers,
+				  &errors[i]);
+	}
+
+	while (wait(&status) > 0) {
+		/* Most likely a machine check or SIGBUS on bad memory */
+		if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+			print("Worker died\r\n");
+			total++;
+		}
+	}
+
+	for (unsigned long i = 0; i < workers; i++)
+		total += errors[i];
+
+	munmap(errors, workers * sizeof(unsigned long));
+
+	return total;
+}
+#endif
+
+static unsigned long run_pass(const struct pass *pass, unsigned long *start,
+			      unsigned long nr_words, unsigned long workers)
+{
+	unsigned long errors;
+
+#if __STDC_HOSTED__ == 1
+	if (workers > 1)
+		return run_pass_parallel(pass, start, nr_words, workers);
+#endif
+
+	run_slice(pass, start, nr_words, 0, 1, &errors);
+
+	return errors;
+}
+
+/* Print bytes per ticks as GB/s with two decimal places */
+static void print_rate(unsigned long bytes, unsigned long ticks)
+{
+	unsigned long rate;
+
+	if (!ticks)
+		ticks = 1;
+
+	/* In units of 10 MB/s, scaled down first to stay within 64 bits */
+	rate = (bytes / 10000) * (timebase_freq() / 1000) / ticks;
+
+	putlong(rate / 100);
+	print(".");
+	putlong(rate / 10 % 10);
+	putlong(rate % 10);
+	print(" GB/s");
+}
+
+void memtest(void *start, void *end, unsigned long workers)
+{
+	unsigned long nr_words = (end - start) / sizeof(unsigned long);
+	unsigned long errors = 0;
+
+	if (end <= start || !nr_words)
+		return;
+
+	if (memtest_table.bits != 32)
+		lfsr_init_table(&memtest_table, 32);
+
+	if (workers > nr_words)
+		workers = nr_words;
+
+	for (unsigned long i = 0; i < NR_PASSES; i++) {
+		const struct pass *pass = &passes[i];
+		unsigned long tb_start, tb_end;
+
+		tb_start = read_timebase();
+		errors += run_pass(pass, start, nr_words, workers);
+		tb_end = read_timebase();
+
+		print(pass->pattern);
+		print(" ");
+		print(pass->phase);
+		print(" ");
+		print_rate(nr_words * sizeof(unsigned long) * pass->accesses,
+			   tb_end - tb_start);
+		print("\r\n");
+	}
+
+	print("Done, ");
+	putlong(errors);
+	print(" errors\r\n");
+}
+
+#if __STDC_HOSTED__ == 1
+void memtest_alloc(unsigned long size, unsigned long workers)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			print("Could not allocate memory\r\n");
+			return;
+		}
+
+		print("No huge pages, using normal pages\r\n");
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+
+	print("Testing ");
+	putlong(size >> 20);
+	print(" MB at ");
+	puthex((unsigned long)p);
+	print("\r\n");
+
+	memtest(p, p + size, workers);
+
+	munmap(p, size);
+}
+#endif
@@ -0,0 +1,7 @@
+/* Run every pattern over [start, end), split across workers if hosted */
+void memtest(void *start, void *end, unsigned long workers);
+
+#if __STDC_HOSTED__ == 1
+/* Allocate a region, preferably from huge pages, and test it */
+void memtest_alloc(unsigned long size, unsigned long workers);
+#endif
@@ -2,6 +2,13 @@
 #include <string.h>
 #include "backend.h"
 #include "uart.h"
+#include "irq.h"
+#include "exceptions.h"
+
+/* The timebase runs at the core clock */
+#ifndef TB_FREQ
+#define TB_FREQ 100000000
+#endif
 
 void init_console(void)
 {
@@ -18,19 +25,91 @@ void *init_memory(void)
 	return (void *)MEM_BASE;
 }
 
-typedef uint64_t (*testfunc)(void *gprs);
+struct vote_stats vote_stats;
+struct testcase_fault testcase_fault;
+struct fault_recovery fault_recovery;
 
-long execute_testcase(void *insns, void *gprs, void *mem_ptr)
+static unsigned long watchdog_ticks;
+
+unsigned long timebase_freq(void)
+{
+	return TB_FREQ;
+}
+
+unsigned long read_timebase(void)
+{
+	unsigned long tb;
+
+	asm volatile("mfspr %0,268" : "=r" (tb));
+
+	return tb;
+}
+
+void set_watchdog(unsigned long ticks)
+{
+	watchdog_ticks = ticks;
+}
+
+typedef uint64_t (*testfunc)(void *gprs, void *mem);
+
+long execute_testcase_once(void *insns, void *gprs, void *mem_ptr)
 {
 	testfunc func;
 	long tb_start, tb_end;
+	unsigned long flags;
 	int dummy;
 
+	testcase_fault.type = 0;
+	testcase_fault.timeout = false;
+
 	memset(mem_ptr, 0, MEM_SIZE);
 	func = (testfunc)insns;
 	asm volatile("stwcx. %1,0,%0" : : "r" (&dummy), "r" (0));
+
+	/* The test case trashes r1, so it can't take interrupts */
+	flags = irq_save();
+
+	fault_recovery.save = (unsigned long)gprs;
+	fault_recovery.code_start = (unsigned long)insns;
+	fault_recovery.code_end = MEM_BASE;
+	asm volatile("mfmsr %0" : "=r" (fault_recovery.msr));
+	fault_recovery.active = 1;
+
+	if (watchdog_ticks) {
+		uart_irq_block();
+		asm volatile("mtdec %0" : : "r" (watchdog_ticks));
+		irq_enable();
+	}
+
 	asm volatile("mfspr %0,268" : "=r" (tb_start));
-	func(gprs);
+	func(gprs, mem_ptr+MEM_SIZE/2);
 	asm volatile("mfspr %0,268" : "=r" (tb_end));
+
+	if (watchdog_ticks) {
+		irq_save();
+		asm volatile("mtdec %0" : : "r" (DEC_IDLE));
+		uart_irq_unblock();
+	}
+
+	if (fault_recovery.active) {
+		fault_recovery.active = 0;
+	} else {
+		testcase_fault.timeout = (fault_recovery.vector == 0x900);
+		testcase_fault.type = fault_recovery.vector;
+		testcase_fault.addr = fault_recovery.srr0;
+		testcase_fault.msr = fault_recovery.srr1;
+		testcase_fault.dar = fault_recovery.dar;
+		testcase_fault.dsisr = fault_recovery.dsisr;
+	}
+
+	irq_restore(flags);
 	return tb_end - tb_start;
 }
+
+/* Nothing to vote with, there is only one core */
+long execute_testcase(void *insns, void *gprs, void *mem_ptr)
+{
+	vote_stats.tests++;
+
+	return execute_testcase_once(insns, gprs, mem_ptr);
+}
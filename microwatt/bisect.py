@@ -0,0 +1,83 @@
+#!/usr/bin/python3
+#
+# Host side of the bisect command, for targets like Microwatt that have
+# no second core to compare against. Starts bisect on the target over its
+# console and answers each "reference <seed> <nr_insns>?" query by running
+# the same test case on a reference simple_random, eg the POSIX build on a
+# known good machine. Both need the same settings (profile, checksum etc).
+#
+# Usage: bisect.py /dev/ttyUSB0 seed nr_insns expected_hash [reference...]
+
+import os
+import subprocess
+import sys
+import termios
+
+BAUD = termios.B115200
+DONE = ("divergence", "no divergence", "reference does not", "reference failed")
+
+
+class Reference:
+    def __init__(self, cmd):
+        self.p = subprocess.Popen(cmd, stdin=subprocess.PIPE,
+                                  stdout=subprocess.PIPE,
+                                  universal_newlines=True)
+
+    def hash(self, seed, nr_insns):
+        self.p.stdin.write("test %d %d\n" % (seed, nr_insns))
+        self.p.stdin.flush()
+        while True:
+            line = self.p.stdout.readline()
+            if not line:
+                raise Exception("reference exited")
+            fields = line.split()
+            if len(fields) >= 2 and fields[0] == str(seed):
+                # The target hashes a test case that faulted to 0 too
+                if fields[1] in ("fault", "timeout"):
+                    return 0
+                return int(fields[1], 16)
+
+
+def open_console(name):
+    fd = os.open(name, os.O_RDWR | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0
+    attrs[1] = 0
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0
+    attrs[4] = attrs[5] = BAUD
+    attrs[6][termios.VMIN] = 1
+    attrs[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def console_lines(fd):
+    buf = b""
+    while True:
+        data = os.read(fd, 4096)
+        if not data:
+            return
+        buf += data
+        while b"\n" in buf:
+            line, buf = buf.split(b"\n", 1)
+            yield line.decode(errors="replace").strip()
+
+
+fd = open_console(sys.argv[1])
+seed, nr_insns, expected = sys.argv[2:5]
+ref = Reference(sys.argv[5:] or ["../posix/simple_random"])
+
+os.write(fd, ("bisect %s %s %s\r" % (seed, nr_insns, expected)).encode())
+
+for line in console_lines(fd):
+    if line.startswith("reference ") and line.endswith("?"):
+        s, n = line[len("reference "):-1].split()
+        h = ref.hash(int(s), int(n))
+        print("%s %s %016x" % (s, n, h))
+        os.write(fd, ("%x\r" % h).encode())
+    elif line.startswith(DONE):
+        print(line)
+        sys.exit(0 if line.startswith("no divergence") else 1)
+
+sys.exit(1)
@@ -0,0 +1,41 @@
+/*
+ * State shared between execute_testcase and the exception handlers in
+ * head.S. While a test case is running, any exception abandons it:
+ * the handler records where it happened and returns through the test
+ * case epilog using the save area, which holds the stack pointer the
+ * prolog saved.
+ */
+#define FR_ACTIVE	0
+#define FR_SAVE		8
+#define FR_MSR		16
+#define FR_VECTOR	24
+#define FR_SRR0		32
+#define FR_SRR1		40
+#define FR_DAR		48
+#define FR_DSISR	56
+#define FR_CODE_START	64
+#define FR_CODE_END	72
+
+/*
+ * The watchdog uses the decrementer, which needs MSR[EE]. A decrementer
+ * interrupt outside the test case code just pushes the decrementer out
+ * and returns.
+ */
+#define DEC_IDLE	0x7fffffff
+
+#ifndef __ASSEMBLER__
+struct fault_recovery {
+	unsigned long active;
+	unsigned long save;
+	unsigned long msr;
+	unsigned long vector;
+	unsigned long srr0;
+	unsigned long srr1;
+	unsigned long dar;
+	unsigned long dsisr;
+	unsigned long code_start;
+	unsigned long code_end;
+};
+
+extern struct fault_recovery fault_recovery;
+#endif
@@ -0,0 +1,53 @@
+#!/usr/bin/python3
+#
+# Turn a golden test_many output (eg POWER9.out) into a C table that can be
+# linked into a self checking image. Only the hashes are stored, the seeds
+# are consecutive starting at the first one in the file.
+#
+# Usage: golden.py golden.out [max_seeds] > golden.c
+
+import sys
+
+nr_insns = None
+first = None
+hashes = []
+limit = int(sys.argv[2]) if len(sys.argv) > 2 and sys.argv[2] else None
+
+with open(sys.argv[1], errors="replace") as f:
+    for line in f:
+        fields = line.split()
+        if "test_many" in fields:
+            nr_insns = int(fields[fields.index("test_many") + 2])
+            continue
+        if len(fields) != 2:
+            continue
+        try:
+            seed = int(fields[0])
+            h = int(fields[1], 16)
+        except ValueError:
+            continue
+        if first is None:
+            first = seed
+        if seed != first + len(hashes):
+            raise Exception("Seeds not consecutive at %d" % seed)
+        if h > 0xffffffff:
+            raise Exception("Hash for seed %d is not a 32 bit jenkins hash" % seed)
+        hashes.append(h)
+        if limit is not None and len(hashes) == limit:
+            break
+
+if nr_insns is None or first is None:
+    raise Exception("No test_many output found in %s" % sys.argv[1])
+
+print("/* Generated by golden.py from %s, do not edit */" % sys.argv[1])
+print("#include <stdint.h>")
+print('#include "golden.h"')
+print()
+print("const unsigned long golden_first_seed = %d;" % first)
+print("const unsigned long golden_nr_insns = %d;" % nr_insns)
+print("const unsigned long golden_count = %d;" % len(hashes))
+print()
+print("const uint32_t golden_hashes[] = {")
+for i in range(0, len(hashes), 6):
+    print("\t" + " ".join("0x%08x," % h for h in hashes[i:i+6]))
+print("};")
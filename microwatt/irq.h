@@ -0,0 +1,26 @@
+#include <stdint.h>
+
+#define MSR_EE		0x8000
+
+static inline unsigned long irq_save(void)
+{
+	unsigned long msr;
+
+	asm volatile("mfmsr %0" : "=r" (msr));
+	asm volatile("mtmsrd %0,1" : : "r" (msr & ~MSR_EE) : "memory");
+
+	return msr;
+}
+
+static inline void irq_restore(unsigned long msr)
+{
+	asm volatile("mtmsrd %0,1" : : "r" (msr) : "memory");
+}
+
+static inline void irq_enable(void)
+{
+	unsigned long msr;
+
+	asm volatile("mfmsr %0" : "=r" (msr));
+	asm volatile("mtmsrd %0,1" : : "r" (msr | MSR_EE) : "memory");
+}
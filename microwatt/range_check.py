@@ -0,0 +1,80 @@
+#!/usr/bin/python3
+#
+# Compare test_range block digests from a target against a golden
+# test_many output (eg POWER9.out), and print the commands that narrow
+# down each mismatching block. Blocks are split by 16 each round until
+# they are small enough to just dump with test_many.
+#
+# Usage: range_check.py golden.out target.out
+
+import sys
+
+FNV_OFFSET = 0xcbf29ce484222325
+FNV_PRIME = 0x100000001b3
+SPLIT = 16
+
+
+def read_golden(name):
+    hashes = {}
+    with open(name, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 2:
+                continue
+            try:
+                hashes[int(fields[0])] = int(fields[1], 16)
+            except ValueError:
+                pass
+    return hashes
+
+
+def read_target(name):
+    params = None
+    digests = []
+    with open(name, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if "test_range" in fields:
+                args = fields[fields.index("test_range") + 1:]
+                params = [int(x) for x in args[:4]]
+                continue
+            if len(fields) != 2:
+                continue
+            try:
+                digests.append((int(fields[0]), int(fields[1], 16)))
+            except ValueError:
+                pass
+    if params is None:
+        raise Exception("No test_range command found in %s" % name)
+    return params, digests
+
+
+def digest(hashes, first, n):
+    d = FNV_OFFSET
+    for seed in range(first, first + n):
+        if seed not in hashes:
+            return None
+        d = ((d ^ hashes[seed]) * FNV_PRIME) & 0xffffffffffffffff
+    return d
+
+
+golden = read_golden(sys.argv[1])
+(first_seed, nr_insns, nr_tests, block_size), digests = read_target(sys.argv[2])
+block_size = max(block_size, 1)
+
+bad = 0
+for seed, d in digests:
+    n = min(block_size, first_seed + nr_tests - seed)
+    expected = digest(golden, seed, n)
+    if expected is None:
+        print("# %d: not in golden file" % seed)
+    elif expected != d:
+        bad += 1
+        if n <= SPLIT:
+            print("test_many %d %d %d" % (seed, nr_insns, n))
+        else:
+            print("test_range %d %d %d %d" %
+                  (seed, nr_insns, n, (n + SPLIT - 1) // SPLIT))
+
+print("# %d of %d blocks differ" % (bad, len(digests)))
+sys.exit(1 if bad else 0)
@@ -0,0 +1,304 @@
+#!/usr/bin/python3
+#
+# Convert between the text test_many output (eg POWER9.out) and the binary
+# records from set format binary (see results.h), and compare two binary
+# result files. Binary input can be a raw console log, the records are
+# found by their magic. Seeds are implied by their place in a block, so
+# the comparison mmaps both files and compares the overlapping seeds of
+# each pair of blocks a chunk at a time, with byte string compares. Only
+# chunks that differ get looked at record by record.
+#
+# Usage: results.py text in.bin > out.txt
+#        results.py binary in.txt out.bin [fingerprint]
+#        results.py compare golden.bin target.bin
+
+import mmap
+import struct
+import sys
+
+MAGIC = b"SRRESULT"
+VERSION = 2
+
+HEADER = struct.Struct("<8sIIIIQII")
+
+RESULTS_XOR = 0x1
+RESULTS_TIMING = 0x2
+
+RESULT_FAULT = 0x80
+RESULT_TIMEOUT = 0x40
+RESULT_VOTES = 0x3f
+
+# Keeps just the fault and timeout bits of a record's last byte
+FLAGS_ONLY = bytes(i & (RESULT_FAULT | RESULT_TIMEOUT) for i in range(256))
+
+# Records compared at a time
+CHUNK = 65536
+
+
+def hash_size(flags):
+    return 8 if flags & RESULTS_XOR else 4
+
+
+def record_size(flags):
+    return hash_size(flags) + (4 if flags & RESULTS_TIMING else 0) + 1
+
+
+class Block:
+    def __init__(self, fields, start):
+        (magic, self.version, self.fingerprint, self.nr_insns,
+         self.nr_records, self.first_seed, self.flags, _) = fields
+        if self.version != VERSION:
+            raise Exception("Unknown results version %d" % self.version)
+        self.start = start
+        self.size = record_size(self.flags)
+
+    def check(self, other):
+        # 0 is unknown, eg text without the test_many line
+        if self.nr_insns and other.nr_insns and \
+           self.nr_insns != other.nr_insns:
+            raise Exception("nr_insns differ: %d vs %d" %
+                            (self.nr_insns, other.nr_insns))
+        if (self.flags ^ other.flags) & RESULTS_XOR:
+            raise Exception("Checksum types differ")
+        if self.fingerprint and other.fingerprint and \
+           self.fingerprint != other.fingerprint:
+            raise Exception("Profiles differ: %08x vs %08x" %
+                            (self.fingerprint, other.fingerprint))
+
+    def offset(self, seed):
+        return self.start + (seed - self.first_seed) * self.size
+
+    def record(self, buf, seed):
+        """(hash, tb_diff, votes, flags) for seed"""
+        off = self.offset(seed)
+        hs = hash_size(self.flags)
+        hash = int.from_bytes(buf[off:off + hs], "little")
+        tb = 0
+        if self.flags & RESULTS_TIMING:
+            tb = int.from_bytes(buf[off + hs:off + hs + 4], "little")
+        last = buf[off + self.size - 1]
+        return (hash, tb, last & RESULT_VOTES,
+                last & (RESULT_FAULT | RESULT_TIMEOUT))
+
+
+def blocks(buf):
+    pos = buf.find(MAGIC)
+    while pos >= 0 and pos + HEADER.size <= len(buf):
+        b = Block(HEADER.unpack_from(buf, pos), pos + HEADER.size)
+        if not b.nr_records:
+            b.nr_records = (len(buf) - b.start) // b.size
+        b.end_seed = b.first_seed + b.nr_records
+        end = b.offset(b.end_seed)
+        if end > len(buf):
+            raise Exception("Truncated results at offset %d" % pos)
+        yield b
+        pos = buf.find(MAGIC, end)
+
+
+def open_mmap(name):
+    f = open(name, "rb")
+    try:
+        return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    except ValueError:
+        # Empty file
+        return b""
+
+
+def to_text(name):
+    buf = open_mmap(name)
+    out = sys.stdout
+    for b in blocks(buf):
+        out.write("test_many %d %d %d\n" %
+                  (b.first_seed, b.nr_insns, b.nr_records))
+        for seed in range(b.first_seed, b.end_seed):
+            hash, tb, votes, flags = b.record(buf, seed)
+            if flags & RESULT_TIMEOUT:
+                out.write("%d timeout %016x\n" % (seed, hash))
+            elif flags & RESULT_FAULT:
+                out.write("%d fault %016x\n" % (seed, hash))
+            elif b.flags & RESULTS_TIMING:
+                out.write("%d %016x %d\n" % (seed, hash, tb))
+            else:
+                out.write("%d %016x\n" % (seed, hash))
+
+
+class Writer:
+    """Streams records out, a new block whenever the seeds skip"""
+
+    def __init__(self, f, fingerprint, xor):
+        self.f = f
+        self.fingerprint = fingerprint
+        self.xor = xor
+        self.nr_insns = 0
+        self.header_pos = None
+
+    def start(self, nr_insns):
+        self.finish()
+        self.nr_insns = nr_insns
+
+    def add(self, seed, hash, tb, flags, timing):
+        if self.header_pos is not None and \
+           (seed != self.first_seed + self.count or timing != self.timing):
+            self.finish()
+        if self.header_pos is None:
+            self.header_pos = self.f.tell()
+            self.first_seed = seed
+            self.timing = timing
+            self.count = 0
+            self.f.write(self.header(0))
+        rec = hash.to_bytes(hash_size(self.flags()), "little")
+        if timing:
+            rec += min(tb, 0xffffffff).to_bytes(4, "little")
+        self.f.write(rec + bytes([flags | 1]))
+        self.count += 1
+
+    def flags(self):
+        return (RESULTS_XOR if self.xor else 0) | \
+               (RESULTS_TIMING if self.timing else 0)
+
+    def header(self, nr_records):
+        return HEADER.pack(MAGIC, VERSION, self.fingerprint, self.nr_insns,
+                           nr_records, self.first_seed, self.flags(), 0)
+
+    def finish(self):
+        if self.header_pos is None:
+            return
+        end = self.f.tell()
+        self.f.seek(self.header_pos)
+        self.f.write(self.header(self.count))
+        self.f.seek(end)
+        self.header_pos = None
+
+
+def parse_text(f):
+    """Yield ("test_many", nr_insns), ("profile", fingerprint) and
+    ("result", seed, hash, tb_diff, flags, timing) from test_many output"""
+    for line in f:
+        fields = line.split()
+        if "test_many" in fields:
+            yield "test_many", int(fields[fields.index("test_many") + 2])
+            continue
+        if "profile" in fields and len(fields) == 3:
+            yield "profile", int(fields[2], 16)
+            continue
+        if len(fields) < 2:
+            continue
+        try:
+            seed = int(fields[0])
+            if fields[1] in ("fault", "timeout"):
+                flags = RESULT_FAULT if fields[1] == "fault" \
+                    else RESULT_TIMEOUT
+                yield "result", seed, int(fields[2], 16), 0, flags, False
+            elif len(fields) == 3:
+                yield ("result", seed, int(fields[1], 16), int(fields[2]),
+                       0, True)
+            elif len(fields) == 2:
+                yield "result", seed, int(fields[1], 16), 0, 0, False
+        except (ValueError, IndexError):
+            pass
+
+
+def to_binary(name, out_name, fingerprint):
+    # Jenkins hashes fit in 32 bits, xor ones practically never do
+    with open(name, errors="replace") as f:
+        xor = any(e[0] == "result" and not e[4] and e[2] > 0xffffffff
+                  for e in parse_text(f))
+
+    with open(name, errors="replace") as f, open(out_name, "wb") as out:
+        w = Writer(out, fingerprint, xor)
+        for e in parse_text(f):
+            if e[0] == "test_many":
+                w.start(e[1])
+            elif e[0] == "profile":
+                w.fingerprint = e[1]
+            else:
+                w.add(*e[1:])
+        w.finish()
+
+
+def describe(hash, votes, flags):
+    if flags & (RESULT_FAULT | RESULT_TIMEOUT):
+        got = "%s %016x" % ("timeout" if flags & RESULT_TIMEOUT
+                            else "fault", hash)
+    else:
+        got = "%016x" % hash
+    return got + (" (%d votes)" % votes if votes > 1 else "")
+
+
+def missing(lo, hi):
+    if hi - lo == 1:
+        print("# %d: not in golden file" % lo)
+    elif hi > lo:
+        print("# %d-%d: not in golden file" % (lo, hi - 1))
+
+
+def compare_range(gbuf, g, tbuf, t, lo, hi):
+    """Compare seeds lo to hi - 1, returns how many differ"""
+    hs = hash_size(g.flags)
+    same_layout = g.size == t.size and not g.flags & RESULTS_TIMING
+    bad = 0
+
+    for first in range(lo, hi, CHUNK):
+        last = min(first + CHUNK, hi)
+        gs, ge = g.offset(first), g.offset(last)
+        ts, te = t.offset(first), t.offset(last)
+
+        # Identical bytes, votes included, is the common case
+        if same_layout and gbuf[gs:ge] == tbuf[ts:te]:
+            continue
+
+        # Otherwise a byte lane of the hashes at a time, and the flags
+        if all(gbuf[gs + k:ge:g.size] == tbuf[ts + k:te:t.size]
+               for k in range(hs)) and \
+           gbuf[gs + g.size - 1:ge:g.size].translate(FLAGS_ONLY) == \
+           tbuf[ts + t.size - 1:te:t.size].translate(FLAGS_ONLY):
+            continue
+
+        for seed in range(first, last):
+            ghash, _, _, gflags = g.record(gbuf, seed)
+            hash, _, votes, flags = t.record(tbuf, seed)
+            if (ghash, gflags) != (hash, flags):
+                bad += 1
+                print("%d expected %016x got %s" %
+                      (seed, ghash, describe(hash, votes, flags)))
+
+    return bad
+
+
+def compare(golden_name, target_name):
+    gbuf = open_mmap(golden_name)
+    tbuf = open_mmap(target_name)
+    golden = sorted(blocks(gbuf), key=lambda b: b.first_seed)
+    n = 0
+    bad = 0
+
+    for t in blocks(tbuf):
+        seed = t.first_seed
+        for g in golden:
+            if g.end_seed <= seed or g.first_seed >= t.end_seed:
+                continue
+            g.check(t)
+            missing(seed, g.first_seed)
+            lo = max(seed, g.first_seed)
+            seed = min(t.end_seed, g.end_seed)
+            bad += compare_range(gbuf, g, tbuf, t, lo, seed)
+            n += seed - lo
+        missing(seed, t.end_seed)
+
+    print("# %d of %d differ" % (bad, n))
+    return bad
+
+
+cmd = sys.argv[1] if len(sys.argv) > 1 else None
+if cmd == "text" and len(sys.argv) == 3:
+    to_text(sys.argv[2])
+elif cmd == "binary" and len(sys.argv) in (4, 5):
+    fp = int(sys.argv[4], 16) if len(sys.argv) == 5 else 0
+    to_binary(sys.argv[2], sys.argv[3], fp)
+elif cmd == "compare" and len(sys.argv) == 4:
+    sys.exit(1 if compare(sys.argv[2], sys.argv[3]) else 0)
+else:
+    print("Usage: results.py text in.bin > out.txt\n"
+          "       results.py binary in.txt out.bin [fingerprint]\n"
+          "       results.py compare golden.bin target.bin", file=sys.stderr)
+    sys.exit(2)
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "irq.h"
 
 /*
  * Core UART functions to implement for a port
@@ -10,7 +11,9 @@
 static uint64_t potato_uart_base;
 
 #define PROC_FREQ 100000000
+#ifndef UART_FREQ
 #define UART_FREQ 115200
+#endif
 #define UART_BASE 0xc0002000
 
 #define POTATO_CONSOLE_TX		0x00
@@ -22,6 +25,19 @@ static uint64_t potato_uart_base;
 #define   POTATO_CONSOLE_STATUS_TX_FULL			0x08
 #define POTATO_CONSOLE_CLOCK_DIV	0x18
 #define POTATO_CONSOLE_IRQ_EN		0x20
+#define   POTATO_CONSOLE_IRQ_RX				0x01
+#define   POTATO_CONSOLE_IRQ_TX				0x02
+
+/*
+ * XICS interrupt controller. The UART is ICS source 0, which is presented
+ * to the ICP as interrupt 16. XICS registers are big endian.
+ */
+#define XICS_ICP_BASE	0xc0004000
+#define XICS_ICS_BASE	0xc0005000
+#define XICS_XIRR	0x4
+#define XICS_XIVE(src)	(0x800 + (src)*4)
+#define UART_IRQ_SRC	0
+#define UART_IRQ_PRIO	0x80
 
 static uint64_t potato_uart_reg_read(int offset)
 {
@@ -92,12 +108,39 @@ static unsigned long potato_uart_divisor(unsigned long proc_freq,
 	return proc_freq / (uart_freq * 16) - 1;
 }
 
+#ifdef UART_TX_IRQ
+static void xics_write32(uint64_t addr, uint32_t val)
+{
+	*(volatile uint32_t *)addr = __builtin_bswap32(val);
+}
+
+static uint32_t xics_read32(uint64_t addr)
+{
+	return __builtin_bswap32(*(volatile uint32_t *)addr);
+}
+
+static void xics_write8(uint64_t addr, uint8_t val)
+{
+	*(volatile uint8_t *)addr = val;
+}
+#endif
+
 void potato_uart_init(void)
 {
 	potato_uart_base = UART_BASE;
 
 	potato_uart_reg_write(POTATO_CONSOLE_CLOCK_DIV,
 			      potato_uart_divisor(PROC_FREQ, UART_FREQ));
+
+#ifdef UART_TX_IRQ
+	potato_uart_reg_write(POTATO_CONSOLE_IRQ_EN, 0);
+
+	/* Route the UART to us and accept interrupts of any priority */
+	xics_write32(XICS_ICS_BASE + XICS_XIVE(UART_IRQ_SRC), UART_IRQ_PRIO);
+	xics_write8(XICS_ICP_BASE + XICS_XIRR, 0xff);
+
+	irq_enable();
+#endif
 }
 
 int getchar_unbuffered(void)
@@ -117,3 +160,83 @@ int putchar_unbuffered(int c)
 
 	return c;
 }
+
+#ifdef UART_TX_IRQ
+/*
+ * Output is queued in a ring and drained by the UART's TX empty interrupt,
+ * so we can get on with generating and running test cases while it goes
+ * out. Test cases run with interrupts off (see execute_testcase), so the
+ * interrupt only ever lands in C code.
+ */
+#define TX_RING_SIZE	4096
+
+static volatile char tx_ring[TX_RING_SIZE];
+static volatile unsigned long tx_head, tx_tail;
+
+static void tx_kick(void)
+{
+	unsigned long flags = irq_save();
+
+	potato_uart_reg_write(POTATO_CONSOLE_IRQ_EN, POTATO_CONSOLE_IRQ_TX);
+
+	irq_restore(flags);
+}
+
+void uart_irq_handler(void)
+{
+	uint32_t xirr = xics_read32(XICS_ICP_BASE + XICS_XIRR);
+
+	while (tx_tail != tx_head && !potato_uart_tx_full()) {
+		potato_uart_write(tx_ring[tx_tail % TX_RING_SIZE]);
+		tx_tail++;
+	}
+
+	if (tx_tail == tx_head)
+		potato_uart_reg_write(POTATO_CONSOLE_IRQ_EN, 0);
+
+	/* EOI */
+	xics_write32(XICS_ICP_BASE + XICS_XIRR, xirr);
+}
+
+/*
+ * Test cases run with the watchdog need MSR[EE] set, but they trash r1 so
+ * they can't take the UART interrupt. Hold it off at the ICP meanwhile.
+ */
+void uart_irq_block(void)
+{
+	xics_write8(XICS_ICP_BASE + XICS_XIRR, 0);
+}
+
+void uart_irq_unblock(void)
+{
+	xics_write8(XICS_ICP_BASE + XICS_XIRR, 0xff);
+}
+
+void write_unbuffered(const char *buf, unsigned long len)
+{
+	while (len--) {
+		/* Ring full, make sure it is draining and wait */
+		while (tx_head - tx_tail == TX_RING_SIZE)
+			tx_kick();
+
+		tx_ring[tx_head % TX_RING_SIZE] = *buf++;
+		tx_head++;
+	}
+
+	tx_kick();
+}
+#else
+void uart_irq_block(void)
+{
+}
+
+void uart_irq_unblock(void)
+{
+}
+
+void write_unbuffered(const char *buf, unsigned long len)
+{
+	while (len--)
+		putchar_unbuffered(*buf++);
+}
+#endif
@@ -1,3 +1,6 @@
 void potato_uart_init(void);
 char getchar_unbuffered(void);
 void putchar_unbuffered(const char c);
+void write_unbuffered(const char *buf, unsigned long len);
+void uart_irq_block(void);
+void uart_irq_unblock(void);
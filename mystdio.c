@@ -1,47 +1,103 @@
 #include <string.h>
 #include <stdint.h>
 #include "backend.h"
-#include "stdio.h"
+#include "mystdio.h"
+
+/*
+ * All output goes through one buffer, which is handed to the backend at
+ * the end of every line, when it fills up, or when flush_output() is
+ * called (eg before we block waiting for input).
+ */
+#define OUTBUF_SIZE	256
+
+static char outbuf[OUTBUF_SIZE];
+static unsigned long outbuf_len;
+
+void flush_output(void)
+{
+	if (outbuf_len)
+		write_unbuffered(outbuf, outbuf_len);
+	outbuf_len = 0;
+}
+
+static void output(const char *str, unsigned long len)
+{
+	while (len) {
+		unsigned long n = OUTBUF_SIZE - outbuf_len;
+
+		if (n > len)
+			n = len;
+
+		memcpy(outbuf + outbuf_len, str, n);
+		outbuf_len += n;
+		str += n;
+		len -= n;
+
+		if (outbuf_len == OUTBUF_SIZE)
+			flush_output();
+	}
+
+	if (outbuf_len && outbuf[outbuf_len-1] == '\n')
+		flush_output();
+}
+
+static const char hexdigits[16] = "0123456789abcdef";
 
 void puthex(uint64_t n)
 {
-	for (long i = 15; i >= 0; i--) {
-		uint8_t x = (n >> (i*4)) & 0xf;
+	char str[16];
 
-		if (x > 9)
-			putchar_unbuffered(x-10+'a');
-		else
-			putchar_unbuffered(x+'0');
+	for (long i = 15; i >= 0; i--) {
+		str[i] = hexdigits[n & 0xf];
+		n >>= 4;
 	}
+
+	output(str, sizeof(str));
 }
 
+static const char decdigits[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
 void putlong(uint64_t n)
 {
-	char str[32];
-	unsigned long i = 0;
+	char str[20];
+	unsigned long i = sizeof(str);
 
-	if (!n) {
-		putchar_unbuffered('0');
-		return;
-	}
+	/* Two digits at a time */
+	while (n >= 100) {
+		unsigned long rem = n % 100;
 
-	while (n != 0) {
-		int rem = n % 10;
+		n /= 100;
+		str[--i] = decdigits[rem*2+1];
+		str[--i] = decdigits[rem*2];
+	}
 
-		str[i++] = rem + '0';
-		n = n / 10;
+	if (n >= 10) {
+		str[--i] = decdigits[n*2+1];
+		str[--i] = decdigits[n*2];
+	} else {
+		str[--i] = n + '0';
 	}
 
-	while (i--)
-		putchar_unbuffered(str[i]);
+	output(str + i, sizeof(str) - i);
 }
 
 void print(const char *str)
 {
-	unsigned long len = strlen(str);
-
-	while (len--)
-		putchar_unbuffered(*str++);
+	output(str, strlen(str));
 }
 
-
+/* Raw bytes, eg binary results, which may contain NULs */
+void putbytes(const void *buf, unsigned long len)
+{
+	output(buf, len);
+}
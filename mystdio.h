@@ -3,3 +3,5 @@
 void puthex(uint64_t n);
 void putlong(uint64_t n);
 void print(const char *str);
+void putbytes(const void *buf, unsigned long len);
+void flush_output(void);
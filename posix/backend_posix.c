@@ -7,57 +7,297 @@
 #include <stdio.h>
 #include <termios.h>
 #include <assert.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/platform/ppc.h>
+#include <stdbool.h>
 #include "backend.h"
+#include "generate.h"
 
+static struct termios saved_termios;
+static bool console_raw;
+
+static void restore_console(void)
+{
+	if (console_raw)
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+	console_raw = false;
+}
+
+static void restore_console_signal(int sig)
+{
+	restore_console();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/*
+ * Put the terminal into non canonical, no echo mode once and put it back
+ * on the way out. If stdin isn't a terminal (eg a piped command file),
+ * leave termios alone.
+ */
 void init_console(void)
 {
+	struct termios t;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios))
+		return;
+
+	t = saved_termios;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &t))
+		return;
+
+	console_raw = true;
+	atexit(restore_console);
+	signal(SIGINT, restore_console_signal);
+	signal(SIGTERM, restore_console_signal);
+	signal(SIGHUP, restore_console_signal);
 }
 
 #define ALIGN_UP(VAL, SIZE)	(((VAL) + ((SIZE)-1)) & ~((SIZE)-1))
 
+static void *mempage;
+
+/*
+ * Test cases can be abandoned from a signal handler, either because they
+ * faulted (eg a newly enabled trap or cache op, or a bad load/store) or
+ * because the watchdog went off. They trash r1 and r13, so the handler
+ * runs on an alternate stack, puts the thread pointer back and siglongjmps
+ * to execute_testcase_once, which restores the stack pointer and non
+ * volatile state. The signal, faulting address and seed end up in the
+ * output and the run carries on with the next seed. The handlers are
+ * SA_NODEFER so the signal mask never changes, and sigsetjmp doesn't
+ * need a syscall to save and restore it on every test case.
+ */
+static sigjmp_buf testcase_env;
+static volatile sig_atomic_t in_testcase;
+static unsigned long testcase_r13;
+static unsigned long watchdog_ticks;
+
+static __attribute__((optimize("no-stack-protector")))
+void testcase_signal(int sig, siginfo_t *info, void *ctx)
+{
+	ucontext_t *uc = ctx;
+
+	asm volatile("mr 13,%0" : : "r" (testcase_r13));
+
+	if (!in_testcase) {
+		/* The watchdog went off after the test case finished */
+		if (sig == SIGALRM)
+			return;
+
+		/* A real bug, let it take us down when the insn restarts */
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	in_testcase = 0;
+
+	testcase_fault.timeout = (sig == SIGALRM);
+	testcase_fault.type = sig;
+	testcase_fault.addr = uc->uc_mcontext.gp_regs[PT_NIP];
+	testcase_fault.msr = uc->uc_mcontext.gp_regs[PT_MSR];
+	testcase_fault.dar = (unsigned long)info->si_addr;
+	testcase_fault.dsisr = uc->uc_mcontext.gp_regs[PT_DSISR];
+
+	siglongjmp(testcase_env, 1);
+}
+
+/* Signals a test case can raise, plus the watchdog */
+static const int testcase_signals[] = {
+	SIGILL, SIGSEGV, SIGBUS, SIGTRAP, SIGFPE, SIGALRM,
+};
+
+/* Older glibc only has the raw union member */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id	_sigev_un._tid
+#endif
+
+/*
+ * The watchdog counts the CPU time of the thread running the test case,
+ * so being preempted can't turn a good seed into a timeout. Timers aren't
+ * inherited across fork, so each worker creates its own on first use.
+ */
+static timer_t watchdog_timer;
+static bool watchdog_created, watchdog_broken;
+
+static void watchdog_forked(void)
+{
+	watchdog_created = false;
+}
+
+static bool create_watchdog(void)
+{
+	struct sigevent sev;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGALRM;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &watchdog_timer)) {
+		/* Say so once and run without it */
+		perror("timer_create");
+		watchdog_broken = true;
+		return false;
+	}
+
+	watchdog_created = true;
+
+	return true;
+}
+
+static void arm_watchdog(unsigned long ticks)
+{
+	struct itimerspec it = { 0 };
+
+	if (!watchdog_created &&
+	    (!ticks || watchdog_broken || !create_watchdog()))
+		return;
+
+	if (ticks) {
+		unsigned long ns = ticks * 1000000000UL / __ppc_get_timebase_freq();
+
+		it.it_value.tv_sec = ns / 1000000000UL;
+		it.it_value.tv_nsec = (ns % 1000000000UL) ?: 1;
+	}
+
+	timer_settime(watchdog_timer, 0, &it, NULL);
+}
+
+static void init_signals(void)
+{
+	struct sigaction sa;
+	stack_t ss;
+
+	ss.ss_sp = malloc(SIGSTKSZ);
+	ss.ss_size = SIGSTKSZ;
+	ss.ss_flags = 0;
+	if (!ss.ss_sp || sigaltstack(&ss, NULL)) {
+		perror("sigaltstack");
+		exit(1);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = testcase_signal;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	for (unsigned long i = 0; i < sizeof(testcase_signals)/sizeof(int); i++)
+		sigaction(testcase_signals[i], &sa, NULL);
+
+	pthread_atfork(NULL, NULL, watchdog_forked);
+}
+
+unsigned long timebase_freq(void)
+{
+	return __ppc_get_timebase_freq();
+}
+
+unsigned long read_timebase(void)
+{
+	unsigned long tb;
+
+	asm volatile("mfspr %0,268" : "=r" (tb));
+
+	return tb;
+}
+
+void set_watchdog(unsigned long ticks)
+{
+	watchdog_ticks = ticks;
+}
+
 void *init_testcase(unsigned long max_insns)
 {
 	void *p;
 
+	init_signals();
+
+	/*
+	 * Golden results depend on the test case and memory window living
+	 * at fixed addresses. If we can't get them (eg vm.mmap_min_addr is
+	 * too high), run from wherever the kernel puts us and use
+	 * relocatable test cases.
+	 */
 	p = mmap((void *)MEMPAGE_BASE, MEMPAGE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
-		 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+		 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
 
-	if (p == MAP_FAILED) {
-		perror("mmap");
-		exit(1);
+	if (p != (void *)MEMPAGE_BASE) {
+		if (p != MAP_FAILED)
+			munmap(p, MEMPAGE_SIZE);
+
+		p = mmap(NULL, MEMPAGE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+
+		fprintf(stderr, "Could not map test case at 0x%x, results "
+			"will not match golden files\n", MEMPAGE_BASE);
+		set_relocatable(true);
 	}
 
 	memset(p, 0, MEMPAGE_SIZE);
+	mempage = p;
 
-	return (void *)INSNS_BASE;
+	return mempage + (INSNS_BASE - MEMPAGE_BASE);
 }
 
 void *init_memory(void)
 {
-	return (void *)MEM_BASE;
+	return mempage + (MEM_BASE - MEMPAGE_BASE);
 }
 
-typedef uint64_t (*testfunc)(void *gprs);
+typedef uint64_t (*testfunc)(void *gprs, void *mem);
 
 long execute_testcase_once(void *insns, void *gprs, void *mem_ptr)
 {
 	testfunc func;
 	unsigned long r1_before = 0, r1_after = 0;
 	unsigned long r13_before = 0, r13_after = 0;
-	long tb_start, tb_end;
+	volatile long tb_start;
+	long tb_end;
 	int dummy;
 
+	testcase_fault.type = 0;
+	testcase_fault.timeout = false;
+
 	memset(mem_ptr, 0, MEM_SIZE);
 	asm volatile("stwcx. %1,0,%0" : : "r" (&dummy), "r" (0));
 
 	asm volatile("mr %0,1" : "=r" (r1_before));
 	asm volatile("mr %0,13" : "=r" (r13_before));
+	testcase_r13 = r13_before;
+
+	if (sigsetjmp(testcase_env, 0)) {
+		/* Abandoned from testcase_signal */
+		if (watchdog_ticks)
+			arm_watchdog(0);
+		asm volatile("mfspr %0,268" : "=r" (tb_end));
+		return tb_end - tb_start;
+	}
 
 	func = (testfunc)insns;
+	if (watchdog_ticks)
+		arm_watchdog(watchdog_ticks);
+	in_testcase = 1;
 	asm volatile("mfspr %0,268" : "=r" (tb_start));
-	func(gprs);
+	func(gprs, mem_ptr+MEM_SIZE/2);
 	asm volatile("mfspr %0,268" : "=r" (tb_end));
+	in_testcase = 0;
+	if (watchdog_ticks)
+		arm_watchdog(0);
 
 	asm volatile("mr %0,1" : "=r" (r1_after));
 	asm volatile("mr %0,13" : "=r" (r13_after));
@@ -70,6 +310,14 @@ long execute_testcase_once(void *insns, void *gprs, void *mem_ptr)
 
 #define NTRIES	5
 
+struct vote_stats vote_stats;
+struct testcase_fault testcase_fault;
+
+/*
+ * Run the test case twice and return straight away if both runs agree,
+ * which is almost always. Only when they disagree do we go on to NTRIES
+ * runs and pick the most popular answer.
+ */
 long execute_testcase(void *insns, void *gprs, void *mem_ptr)
 {
 	long int i, j;
@@ -78,12 +326,19 @@ long execute_testcase(void *insns, void *gprs, void *mem_ptr)
 	long int tbdiff, tbd[NTRIES];
 	long int nc = 0;
 
+	vote_stats.tests++;
+
 	for (j = 0; j < NTRIES; ++j) {
 		count[j] = 0;
 		tbd[j] = 0;
 	}
 	for (i = 0; i < NTRIES; ++i) {
 		tbdiff = execute_testcase_once(insns, gprs, mem_ptr);
+
+		/* No point voting on a test case that faulted */
+		if (testcase_fault.type)
+			return tbdiff;
+
 		((unsigned long *)gprs)[31] = 0;
 		for (j = 0; j < nc; ++j)
 			if (memcmp(gprs, results[j], NGPRS * sizeof(unsigned long)) == 0)
@@ -94,7 +349,17 @@ long execute_testcase(void *insns, void *gprs, void *mem_ptr)
 			tbd[j] = tbdiff;
 			++nc;
 		}
+
+		if (i == 1) {
+			/* The first two runs agree, we are done */
+			if (nc == 1)
+				return tbd[0];
+
+			vote_stats.escalations++;
+		}
 	}
+	vote_stats.disagreements += nc - 1;
+
 	/* Pick the most popular answer. */
 	i = 0;
 	memcpy(gprs, results[0], NGPRS * sizeof(unsigned long));
@@ -114,19 +379,30 @@ void putchar_unbuffered(const char c)
 	putchar(c);
 }
 
+void write_unbuffered(const char *buf, unsigned long len)
+{
+	fwrite(buf, 1, len, stdout);
+}
+
+static char inbuf[4096];
+static ssize_t inbuf_pos, inbuf_len;
+
 char getchar_unbuffered(void)
 {
-	struct termios oldt, newt;
-	int ch;
+	if (inbuf_pos == inbuf_len) {
+		/* Make sure the prompt is out before we block */
+		fflush(stdout);
 
-	tcgetattr(STDIN_FILENO, &oldt);
-	newt = oldt;
-	newt.c_lflag &= ~(ICANON | ECHO);
-	tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+		do {
+			inbuf_len = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+		} while (inbuf_len < 0 && errno == EINTR);
 
-	ch = getchar();
+		/* Nothing more to read, we are done */
+		if (inbuf_len <= 0)
+			exit(0);
 
-	tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+		inbuf_pos = 0;
+	}
 
-	return ch;
+	return inbuf[inbuf_pos++];
 }
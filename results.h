@@ -0,0 +1,47 @@
+#include <stdint.h>
+
+/*
+ * Binary form of test and test_many results (set format binary). Each
+ * command sends a header followed by nr_records records, one per seed
+ * counting up from first_seed, so the results can be picked out of a
+ * console log by looking for the magic. A record is the hash, then
+ * tb_diff if RESULTS_TIMING, then one byte of flags and votes. Fields are
+ * in the target's byte order, which is little endian everywhere we build.
+ * See microwatt/results.py.
+ */
+#define RESULTS_MAGIC		"SRRESULT"
+#define RESULTS_VERSION		2
+
+/* results_header flags */
+#define RESULTS_XOR		0x1	/* checksum xor, 8 byte hashes */
+#define RESULTS_TIMING		0x2	/* records have a 4 byte tb_diff */
+
+struct results_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t fingerprint;		/* generator_fingerprint() */
+	uint32_t nr_insns;
+	uint32_t nr_records;		/* 0 = up to the end of the file */
+	uint64_t first_seed;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+/*
+ * The last byte of a record. The hash is the fault type when either flag
+ * is set, votes is how many distinct answers there were and saturates.
+ */
+#define RESULT_FAULT		0x80
+#define RESULT_TIMEOUT		0x40
+#define RESULT_VOTES		0x3f
+
+/* Hashes are 4 bytes, jenkins is a 32 bit hash */
+static inline unsigned long result_hash_size(uint32_t flags)
+{
+	return (flags & RESULTS_XOR) ? 8 : 4;
+}
+
+static inline unsigned long result_record_size(uint32_t flags)
+{
+	return result_hash_size(flags) + ((flags & RESULTS_TIMING) ? 4 : 0) + 1;
+}
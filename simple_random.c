@@ -1,3 +1,7 @@
+#if __STDC_HOSTED__ == 1
+#define _GNU_SOURCE
+#endif
+
 #include <stdbool.h>
 #include <string.h>
 
@@ -8,103 +12,1698 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #endif
 
 #include "generate.h"
 #include "backend.h"
 #include "jenkins.h"
 #include "microrl.h"
-#include "lfsr.h"
+#include "memtest.h"
 #include "mystdio.h"
+#include "results.h"
+#ifdef GOLDEN_TABLE
+#include "golden.h"
+#endif
 
 #define MAX_INSNS	8192
 #define SLACK		512
 
-static void microrl_print(microrl_t *pThis, const char *str)
+static void microrl_print(microrl_t *pThis, const char *str)
+{
+	print(str);
+}
+
+static bool registers;
+static bool insns;
+static bool timing;
+
+/*
+ * Watchdog budget in timebase ticks: a fixed allowance plus so much per
+ * instruction. 0 ticks per instruction disables it. Under an OS arming it
+ * costs two syscalls per test case, so there it is off until asked for.
+ */
+#define WATCHDOG_BASE	100000
+#if __STDC_HOSTED__ == 1
+static unsigned long watchdog_per_insn = 0;
+#else
+static unsigned long watchdog_per_insn = 1000;
+#endif
+static enum { JENKINS, XOR } hash_type = JENKINS;
+static enum { TEXT, BINARY } format = TEXT;
+static void *insns_ptr;
+static void *mem_ptr;
+
+/* Set while test or test_many results are going out as binary records */
+static bool binary;
+static uint32_t binary_flags;
+
+/* How many distinct answers the backend saw for the last test case */
+static unsigned long last_votes;
+
+/* Set to end test_many early, eg after too many golden mismatches */
+static bool stop_tests;
+
+static const char *extra_names[4] = { "CR", "LR", "CTR", "XER" };
+
+static uint8_t __atoi_one(uint8_t x)
+{
+	uint8_t v;
+
+	if (x >= 'a')
+		v = x - 'a' + 10;
+	else if (x >= 'A')
+		v = x - 'A' + 10;
+	else
+		v = x - '0';
+
+	return v;
+}
+
+static unsigned long __atoi(const char *str, uint8_t base)
+{
+	unsigned long ret = 0;
+
+	for (unsigned long i = 0; str[i] != 0x0; i++)
+		ret = ret * base + __atoi_one(str[i]);
+
+	return ret;
+}
+
+static uint64_t hash_gprs(unsigned long *gprs)
+{
+	uint64_t hash = 0;
+
+	if (hash_type == XOR) {
+		for (unsigned long i = 0; i < NGPRS; i++)
+			hash ^= gprs[i];
+	} else {
+		hash = jhash2((uint32_t *)gprs,
+			      NGPRS*sizeof(unsigned long)/sizeof(uint32_t), 0);
+	}
+
+	return hash;
+}
+
+#if __STDC_HOSTED__ == 1
+/*
+ * Live comparison against a golden file (set golden), either text
+ * test_many output like POWER9.out or binary results. The file is mmapped
+ * and walked in seed order alongside test_many, so only mismatches get
+ * printed, and the run can stop after maxfail of them. next picks up the
+ * stopped run after the last mismatch.
+ */
+#define GOLDEN_PROGRESS		10000
+
+static struct {
+	const char *buf;
+	size_t size;
+	size_t pos;
+	bool binary;
+	unsigned long nr_insns;
+	int xor;		/* checksum xor, -1 if there are no hashes */
+	/* The binary block we are in */
+	size_t block_start;
+	size_t block_end;
+	unsigned long block_seed;
+	unsigned long record_size;
+	uint32_t block_flags;
+	/* The entry before pos, and whether it is the one we looked for */
+	bool valid;
+	bool found;
+	unsigned long seed;
+	uint64_t hash;
+	bool fault;
+} golden;
+
+static unsigned long max_mismatches;
+static unsigned long golden_checked, golden_mismatches;
+/* golden_checked just reached a multiple of GOLDEN_PROGRESS */
+static bool golden_progress;
+
+static struct {
+	unsigned long seed, end, nr_insns;
+} resume;
+
+static const char *parse_num(const char *p, const char *end,
+			     unsigned long base, unsigned long *val)
+{
+	const char *start;
+
+	while (p < end && *p == ' ')
+		p++;
+
+	start = p;
+	*val = 0;
+	while (p < end) {
+		unsigned long d;
+
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if (base == 16 && *p >= 'a' && *p <= 'f')
+			d = *p - 'a' + 10;
+		else
+			break;
+		*val = *val * base + d;
+		p++;
+	}
+
+	return p == start ? NULL : p;
+}
+
+/* Parse a "seed hash" or "seed fault ..." line */
+static bool golden_parse_line(const char *p, const char *end)
+{
+	unsigned long seed, hash;
+
+	p = parse_num(p, end, 10, &seed);
+	if (!p || p == end || *p != ' ')
+		return false;
+
+	while (p < end && *p == ' ')
+		p++;
+
+	if ((end - p >= 5 && !memcmp(p, "fault", 5)) ||
+	    (end - p >= 7 && !memcmp(p, "timeout", 7))) {
+		golden.fault = true;
+		golden.hash = 0;
+	} else {
+		p = parse_num(p, end, 16, &hash);
+		if (!p)
+			return false;
+		golden.fault = false;
+		golden.hash = hash;
+	}
+
+	golden.seed = seed;
+	golden.valid = true;
+
+	return true;
+}
+
+static void golden_advance(void)
+{
+	golden.valid = false;
+
+	while (golden.pos < golden.size) {
+		const char *p = golden.buf + golden.pos;
+		size_t left = golden.size - golden.pos;
+
+		if (!golden.binary) {
+			const char *nl = memchr(p, '\n', left);
+			const char *end = nl ? nl : p + left;
+
+			golden.pos = end - golden.buf + 1;
+			if (golden_parse_line(p, end))
+				return;
+			continue;
+		}
+
+		if (golden.pos < golden.block_end &&
+		    golden.pos + golden.record_size <= golden.block_end) {
+			uint64_t hash = 0;
+
+			memcpy(&hash, p, result_hash_size(golden.block_flags));
+			golden.seed = golden.block_seed + (golden.pos -
+				golden.block_start) / golden.record_size;
+			golden.hash = hash;
+			golden.fault = p[golden.record_size - 1] &
+				       (RESULT_FAULT | RESULT_TIMEOUT);
+			golden.pos += golden.record_size;
+			golden.valid = true;
+			return;
+		}
+
+		p = memmem(p, left, RESULTS_MAGIC, 8);
+		if (!p || golden.buf + golden.size - p <
+			  sizeof(struct results_header)) {
+			golden.pos = golden.size;
+			return;
+		} else {
+			struct results_header h;
+
+			memcpy(&h, p, sizeof(h));
+			golden.pos = p - golden.buf + sizeof(h);
+			golden.block_start = golden.pos;
+			golden.block_seed = h.first_seed;
+			golden.block_flags = h.flags;
+			golden.record_size = result_record_size(h.flags);
+			golden.block_end = golden.size;
+			if (h.nr_records && golden.pos + h.nr_records *
+			    golden.record_size < golden.size)
+				golden.block_end = golden.pos + h.nr_records *
+					golden.record_size;
+		}
+	}
+}
+
+static void golden_rewind(void)
+{
+	golden.pos = 0;
+	golden.block_end = 0;
+	golden_advance();
+}
+
+static bool golden_find(unsigned long seed)
+{
+	/* Still the last seed in the file once we have run off the end */
+	if (golden.seed > seed)
+		golden_rewind();
+
+	while (golden.valid && golden.seed < seed)
+		golden_advance();
+
+	golden.found = golden.valid && golden.seed == seed;
+
+	return golden.found;
+}
+
+static void unload_golden(void)
+{
+	if (golden.buf)
+		munmap((void *)golden.buf, golden.size);
+	golden.buf = NULL;
+}
+
+static void load_golden(const char *name)
+{
+	struct stat st;
+	const char *p;
+	void *buf;
+	int fd;
+
+	unload_golden();
+
+	if (!strcmp(name, "off"))
+		return;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+		print("Could not open golden file\r\n");
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		print("Could not map golden file\r\n");
+		return;
+	}
+
+	golden.buf = buf;
+	golden.size = st.st_size;
+	golden.nr_insns = 0;
+
+	p = memmem(buf, st.st_size, RESULTS_MAGIC, 8);
+	golden.binary = p && golden.buf + golden.size - p >=
+			     sizeof(struct results_header);
+	if (golden.binary) {
+		struct results_header h;
+
+		memcpy(&h, p, sizeof(h));
+		if (h.version != RESULTS_VERSION) {
+			print("Unknown golden file version\r\n");
+			unload_golden();
+			return;
+		}
+		golden.nr_insns = h.nr_insns;
+		golden.xor = !!(h.flags & RESULTS_XOR);
+	} else {
+		p = memmem(buf, st.st_size, "test_many ", 10);
+		if (p) {
+			const char *end = golden.buf + golden.size;
+			unsigned long seed;
+
+			p = parse_num(p + 10, end, 10, &seed);
+			if (p)
+				parse_num(p, end, 10, &golden.nr_insns);
+		}
+
+		/* Jenkins hashes are 32 bits, xor ones use all 64 */
+		golden.xor = -1;
+		golden_rewind();
+		do
+			golden_advance();
+		while (golden.valid && golden.fault);
+		if (golden.valid)
+			golden.xor = golden.hash > 0xffffffffUL;
+	}
+
+	golden_rewind();
+}
+
+/* True if the result doesn't match, and it should be printed */
+static bool golden_mismatch(unsigned long seed, uint64_t hash, bool fault)
+{
+	bool bad = false;
+
+	/* Before this result, so it doesn't split a mismatch line */
+	if (golden_progress) {
+		putlong(golden_checked);
+		print(" checked, ");
+		putlong(golden_mismatches);
+		print(" mismatches\r\n");
+		golden_progress = false;
+	}
+
+	if (!golden_find(seed))
+		return true;
+
+	golden_checked++;
+	if (golden_checked % GOLDEN_PROGRESS == 0)
+		golden_progress = true;
+	if (golden.fault != fault || (!fault && golden.hash != hash)) {
+		golden_mismatches++;
+		bad = true;
+
+		if (max_mismatches && golden_mismatches >= max_mismatches &&
+		    !stop_tests) {
+			stop_tests = true;
+			resume.seed = seed + 1;
+		}
+	}
+
+	return bad;
+}
+
+/* What golden_mismatch found, at the end of a printed result line */
+static void print_expected(void)
+{
+	if (!golden.found) {
+		print(" not in golden file");
+	} else if (golden.fault) {
+		print(" expected fault");
+	} else {
+		print(" expected ");
+		puthex(golden.hash);
+	}
+}
+#endif
+
+/* The seed is implied, records go out in seed order */
+static void put_record(uint64_t hash, long tb_diff, unsigned long flags)
+{
+	unsigned char r[8 + 4 + 1];
+	unsigned long n = result_hash_size(binary_flags);
+
+	memcpy(r, &hash, n);
+	if (binary_flags & RESULTS_TIMING) {
+		uint32_t tb = tb_diff < 0 ? 0 :
+			      tb_diff > 0xffffffffL ? 0xffffffff : tb_diff;
+
+		memcpy(r + n, &tb, sizeof(tb));
+		n += sizeof(tb);
+	}
+	r[n++] = flags | (last_votes > RESULT_VOTES ? RESULT_VOTES : last_votes);
+
+	putbytes(r, n);
+}
+
+/* If the test case faulted, say so instead of printing a hash */
+static bool print_fault(unsigned long seed, const struct testcase_fault *f)
+{
+#if __STDC_HOSTED__ == 1
+	bool mismatch = false;
+#endif
+
+	if (!f->type)
+		return false;
+
+#if __STDC_HOSTED__ == 1
+	if (golden.buf) {
+		if (!golden_mismatch(seed, 0, true))
+			return true;
+		mismatch = true;
+	}
+#endif
+
+	if (binary) {
+		put_record(f->type, 0, f->timeout ? RESULT_TIMEOUT : RESULT_FAULT);
+		return true;
+	}
+
+	putlong(seed);
+	if (f->timeout)
+		print(" timeout ");
+	else
+		print(" fault ");
+	puthex(f->type);
+	print(" ");
+	puthex(f->addr);
+	print(" ");
+	puthex(f->msr);
+	print(" ");
+	puthex(f->dar);
+	print(" ");
+	puthex(f->dsisr);
+#if __STDC_HOSTED__ == 1
+	if (mismatch)
+		print_expected();
+#endif
+	print("\r\n");
+
+	return true;
+}
+
+/* The same for the test case we just ran */
+static bool report_fault(unsigned long seed)
+{
+	return print_fault(seed, &testcase_fault);
+}
+
+static void arm_watchdog(unsigned long nr_insns)
+{
+	if (watchdog_per_insn)
+		set_watchdog(WATCHDOG_BASE + nr_insns * watchdog_per_insn);
+	else
+		set_watchdog(0);
+}
+
+static void print_profile(void)
+{
+	print("profile ");
+	print(get_profile());
+	print(" ");
+	puthex(generator_fingerprint());
+	print("\r\n");
+}
+
+/* generator_fingerprint() of the generator as it starts up */
+static uint32_t default_fingerprint;
+
+/*
+ * Results from anything but the default generator can't be compared
+ * against golden files, so say which one produced them. That includes
+ * the default profile with changed weights, enables or sampler.
+ */
+static void announce_profile(void)
+{
+	if (generator_fingerprint() != default_fingerprint)
+		print_profile();
+}
+
+/* The seed and hash line, optionally with how long the test case took */
+static void print_hash(unsigned long seed, uint64_t hash, long tb_diff)
+{
+#if __STDC_HOSTED__ == 1
+	bool mismatch = false;
+
+	if (golden.buf) {
+		if (!golden_mismatch(seed, hash, false))
+			return;
+		mismatch = true;
+	}
+#endif
+
+	if (binary) {
+		put_record(hash, tb_diff, 0);
+		return;
+	}
+
+	putlong(seed);
+	print(" ");
+	puthex(hash);
+	if (timing) {
+		print(" ");
+		putlong(tb_diff);
+	}
+#if __STDC_HOSTED__ == 1
+	if (mismatch)
+		print_expected();
+#endif
+	print("\r\n");
+}
+
+/*
+ * With set format binary, test and test_many send a header and then one
+ * record per seed in place of the text lines. Register dumps and
+ * instruction listings stay text, and so do golden file mismatches.
+ * Returns false if the tests should not be run.
+ */
+static bool begin_results(unsigned long seed, unsigned long nr_insns,
+			  unsigned long nr_tests)
+{
+	struct results_header h = {
+		.magic = RESULTS_MAGIC,
+		.version = RESULTS_VERSION,
+		.fingerprint = generator_fingerprint(),
+		.nr_insns = nr_insns,
+		.nr_records = nr_tests,
+		.first_seed = seed,
+		.flags = (hash_type == XOR ? RESULTS_XOR : 0) |
+			 (timing ? RESULTS_TIMING : 0),
+	};
+
+#if __STDC_HOSTED__ == 1
+	if (golden.buf) {
+		if (golden.nr_insns && golden.nr_insns != nr_insns) {
+			print("Golden file is for ");
+			putlong(golden.nr_insns);
+			print(" insns\r\n");
+			return false;
+		}
+
+		if (golden.xor >= 0 && golden.xor != (hash_type == XOR)) {
+			print("Golden file is for checksum ");
+			print(golden.xor ? "xor" : "jenkins");
+			print("\r\n");
+			return false;
+		}
+
+		golden_checked = 0;
+		golden_mismatches = 0;
+		golden_progress = false;
+		stop_tests = false;
+		resume.seed = seed + nr_tests;
+		resume.end = seed + nr_tests;
+		resume.nr_insns = nr_insns;
+		return true;
+	}
+#endif
+
+	if (format != BINARY || registers || insns || nr_insns > MAX_INSNS)
+		return true;
+
+	putbytes(&h, sizeof(h));
+	binary = true;
+	binary_flags = h.flags;
+
+	return true;
+}
+
+static void end_results(void)
+{
+	binary = false;
+
+#if __STDC_HOSTED__ == 1
+	if (!golden.buf)
+		return;
+
+	putlong(golden_checked);
+	print(" checked, ");
+	putlong(golden_mismatches);
+	print(" mismatches\r\n");
+
+	if (stop_tests && resume.seed < resume.end) {
+		print("stopped, next resumes at seed ");
+		putlong(resume.seed);
+		print("\r\n");
+	}
+	stop_tests = false;
+#endif
+}
+
+static long execute_voted(void *gprs)
+{
+	unsigned long disagreements = vote_stats.disagreements;
+	long tb_diff;
+
+	tb_diff = execute_testcase(insns_ptr, gprs, mem_ptr);
+	last_votes = 1 + vote_stats.disagreements - disagreements;
+
+	return tb_diff;
+}
+
+/*
+ * Run one test case and return the hash of its registers, or 0 if it
+ * faulted (check testcase_fault).
+ */
+static uint64_t run_one_hash(unsigned long seed, unsigned long nr_insns,
+			     long *tb_diff)
+{
+	unsigned long gprs[NGPRS + GPR_TABLE_WORDS];
+
+	generate_testcase(insns_ptr, mem_ptr+MEM_SIZE/2, gprs, seed, nr_insns,
+			  false, false);
+	arm_watchdog(nr_insns);
+	*tb_diff = execute_voted(gprs);
+
+	if (testcase_fault.type)
+		return 0;
+
+	/* GPR 31 was our scratch space, clear it */
+	gprs[31] = 0;
+
+	return hash_gprs(gprs);
+}
+
+static long run_one_test(unsigned long seed, unsigned long nr_insns)
+{
+	unsigned long gprs[NGPRS + GPR_TABLE_WORDS];
+	long tb_diff;
+
+	if (nr_insns > MAX_INSNS) {
+		print("Increase MAX_INSNS\r\n");
+		return 0;
+	}
+
+	generate_testcase(insns_ptr, mem_ptr+MEM_SIZE/2, gprs, seed, nr_insns,
+			  insns, false);
+	arm_watchdog(nr_insns);
+	tb_diff = execute_voted(gprs);
+
+	if (report_fault(seed))
+		return tb_diff;
+
+	/* GPR 31 was our scratch space, clear it */
+	gprs[31] = 0;
+
+	if (registers) {
+		for (unsigned long i = 0; i < NGPRS; i++) {
+			if (i < 32)
+				putlong(i);
+			else
+				print(extra_names[i-32]);
+			print(" ");
+			if (i != 31)
+				puthex(gprs[i]);
+			print("\r\n");
+		}
+		print("Memory @ ");
+		puthex((unsigned long)mem_ptr);
+		for (unsigned long i = 0; i < MEM_SIZE; i += sizeof(unsigned long)) {
+			if (i % 32 == 0)
+				print("\r\n");
+			else
+				print(" ");
+			puthex(*(unsigned long *)(mem_ptr + i));
+		}
+
+		print("\r\n\r\n");
+	} else {
+		print_hash(seed, hash_gprs(gprs), tb_diff);
+	}
+
+	return tb_diff;
+}
+
+/*
+ * Packed test_many (set pack K), K seeds per call through generate_packed.
+ * There is no voting, and a pack that faults or traps is finished off
+ * one seed at a time from the seed that stopped it, so the output is the
+ * same as the serial path. The save array lives in the test case page after the
+ * memory window, where every backend can reach it.
+ */
+#define PACK_MAX		32
+#define PACK_SAVE_OFFSET	4096
+
+static unsigned long pack;
+
+static bool use_packed(unsigned long nr_insns)
+{
+	return pack > 1 && !registers && !insns && !timing &&
+	       !get_relocatable() && nr_insns <= MAX_INSNS;
+}
+
+static long run_hashes_packed(unsigned long seed, unsigned long nr_insns,
+			      unsigned long n, uint64_t *hashes,
+			      struct testcase_fault *faults, uint8_t *answers)
+{
+	unsigned long *save = mem_ptr + PACK_SAVE_OFFSET;
+	long tb_ticks = 0;
+
+	for (unsigned long i = 0; i < n; ) {
+		unsigned long k = n - i, done;
+		long tb_diff;
+
+		if (k > pack)
+			k = pack;
+
+		/* Clear the done marks, see generate_packed */
+		for (unsigned long j = 0; j < k; j++)
+			save[(j + 1) * NGPRS + 31] = 0;
+
+		generate_packed(insns_ptr, mem_ptr, mem_ptr+MEM_SIZE/2, save,
+				seed + i, &k, nr_insns);
+
+		if (watchdog_per_insn)
+			set_watchdog(k * (WATCHDOG_BASE +
+					  nr_insns * watchdog_per_insn));
+		else
+			set_watchdog(0);
+
+		if (k) {
+			tb_ticks += execute_testcase_once(insns_ptr, save, mem_ptr);
+			vote_stats.tests += k;
+		}
+
+		/* Everything before the first body that didn't finish is good */
+		for (done = 0; done < k; done++) {
+			unsigned long *slot = &save[(done + 1) * NGPRS];
+
+			if (slot[31] != (unsigned long)slot)
+				break;
+		}
+
+		for (unsigned long j = 0; j < done; j++) {
+			unsigned long *gprs = &save[(j + 1) * NGPRS];
+
+			/* GPR 31 was our scratch space, clear it */
+			gprs[31] = 0;
+			hashes[i + j] = hash_gprs(gprs);
+			faults[i + j] = (struct testcase_fault){ 0 };
+			answers[i + j] = 1;
+		}
+		i += done;
+
+		/* The one that faulted, or one too big to pack */
+		if (done < k || !k) {
+			hashes[i] = run_one_hash(seed + i, nr_insns, &tb_diff);
+			faults[i] = testcase_fault;
+			answers[i] = last_votes;
+			tb_ticks += tb_diff;
+			i++;
+		}
+	}
+
+	return tb_ticks;
+}
+
+static void run_many_tests_packed(unsigned long seed, unsigned long nr_insns,
+				  unsigned long nr_tests)
+{
+	uint64_t hashes[PACK_MAX];
+	struct testcase_fault faults[PACK_MAX];
+	uint8_t answers[PACK_MAX];
+	long tb_ticks = 0;
+
+	for (unsigned long i = 0; i < nr_tests && !stop_tests; i += pack) {
+		unsigned long n = nr_tests - i;
+
+		if (n > pack)
+			n = pack;
+
+		tb_ticks += run_hashes_packed(seed + i, nr_insns, n, hashes,
+					      faults, answers);
+
+		for (unsigned long j = 0; j < n && !stop_tests; j++) {
+			last_votes = answers[j];
+			if (!print_fault(seed + i + j, &faults[j]))
+				print_hash(seed + i + j, hashes[j], 0);
+		}
+	}
+
+	print("timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+}
+
+#if __STDC_HOSTED__ == 1
+static unsigned long nr_workers = 1;
+
+#define MEMTEST_SIZE		(256UL << 20)
+
+/*
+ * Parallel test_many. Each worker is a forked process, so it gets a private
+ * copy of the MAP_FIXED code page and scratch memory at the same addresses as
+ * the parent, and a GPR save area on its own stack. Keeping the addresses
+ * identical matters, because the load/store base registers end up in the
+ * hash.
+ *
+ * The seed range is split into chunks that workers claim in order. Results
+ * go into a shared ring of chunk slots, and the parent prints them in seed
+ * order so the output is identical to the serial version.
+ */
+#define CHUNK_SIZE		256
+#define SLOTS_PER_WORKER	4
+
+struct chunk {
+	unsigned long ready;		/* chunk number + 1 once filled */
+	long tb_ticks;
+	struct vote_stats votes;
+	uint64_t hashes[CHUNK_SIZE];
+	long tb[CHUNK_SIZE];
+	uint8_t answers[CHUNK_SIZE];
+	struct testcase_fault faults[CHUNK_SIZE];
+};
+
+struct parallel_state {
+	unsigned long next_chunk;
+	unsigned long printed;
+	unsigned long nr_slots;
+	struct chunk chunks[];
+};
+
+static void parallel_worker(struct parallel_state *s, unsigned long seed,
+			    unsigned long nr_insns, unsigned long nr_tests)
+{
+	unsigned long nr_chunks = (nr_tests + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	while (1) {
+		unsigned long c, first, n;
+		struct chunk *slot;
+
+		c = __atomic_fetch_add(&s->next_chunk, 1, __ATOMIC_RELAXED);
+		if (c >= nr_chunks)
+			break;
+
+		/* Wait for the parent to drain the slot we are about to reuse */
+		while (c >= __atomic_load_n(&s->printed, __ATOMIC_ACQUIRE) +
+			    s->nr_slots)
+			sched_yield();
+
+		slot = &s->chunks[c % s->nr_slots];
+		first = c * CHUNK_SIZE;
+		n = nr_tests - first;
+		if (n > CHUNK_SIZE)
+			n = CHUNK_SIZE;
+
+		slot->tb_ticks = 0;
+		vote_stats = (struct vote_stats){ 0 };
+		if (use_packed(nr_insns)) {
+			slot->tb_ticks = run_hashes_packed(seed + first, nr_insns,
+							   n, slot->hashes,
+							   slot->faults,
+							   slot->answers);
+		} else {
+			for (unsigned long i = 0; i < n; i++) {
+				long tb_diff;
+
+				slot->hashes[i] = run_one_hash(seed + first + i,
+							       nr_insns,
+							       &tb_diff);
+				slot->faults[i] = testcase_fault;
+				slot->answers[i] = last_votes;
+				slot->tb[i] = tb_diff;
+				slot->tb_ticks += tb_diff;
+			}
+		}
+		slot->votes = vote_stats;
+
+		__atomic_store_n(&slot->ready, c + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static bool run_many_tests_parallel(unsigned long seed, unsigned long nr_insns,
+				    unsigned long nr_tests)
+{
+	unsigned long nr_chunks = (nr_tests + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	unsigned long workers = nr_workers;
+	struct parallel_state *s;
+	unsigned long nr_slots;
+	unsigned long done = 0;
+	long tb_ticks = 0;
+	bool failed = false;
+	size_t size;
+	pid_t *pids;
+
+	if (workers > nr_chunks)
+		workers = nr_chunks;
+
+	nr_slots = workers * SLOTS_PER_WORKER;
+	size = sizeof(*s) + nr_slots * sizeof(struct chunk);
+
+	s = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+		 -1, 0);
+	if (s == MAP_FAILED)
+		return false;
+
+	pids = calloc(workers, sizeof(pid_t));
+	if (!pids) {
+		munmap(s, size);
+		return false;
+	}
+
+	s->next_chunk = 0;
+	s->printed = 0;
+	s->nr_slots = nr_slots;
+	for (unsigned long i = 0; i < nr_slots; i++)
+		s->chunks[i].ready = 0;
+
+	/* Don't let the children inherit unflushed output */
+	flush_output();
+	fflush(stdout);
+
+	for (unsigned long i = 0; i < workers; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			parallel_worker(s, seed, nr_insns, nr_tests);
+			_exit(0);
+		}
+		if (pids[i] < 0) {
+			print("fork failed\r\n");
+			failed = true;
+			workers = i;
+			break;
+		}
+	}
+
+	for (unsigned long c = 0; c < nr_chunks && !failed && !stop_tests; c++) {
+		struct chunk *slot = &s->chunks[c % nr_slots];
+		unsigned long first = c * CHUNK_SIZE;
+		unsigned long n = nr_tests - first;
+
+		if (n > CHUNK_SIZE)
+			n = CHUNK_SIZE;
+
+		while (__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE) != c + 1) {
+			int status;
+
+			/* A worker that died will never fill its chunk */
+			if (waitpid(-1, &status, WNOHANG) > 0 &&
+			    !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+				print("Worker died\r\n");
+				failed = true;
+				break;
+			}
+			usleep(100);
+		}
+
+		if (failed)
+			break;
+
+		for (unsigned long i = 0; i < n && !stop_tests; i++) {
+			last_votes = slot->answers[i];
+			if (!print_fault(seed + first + i, &slot->faults[i]))
+				print_hash(seed + first + i, slot->hashes[i],
+					   slot->tb[i]);
+		}
+		tb_ticks += slot->tb_ticks;
+		vote_stats.tests += slot->votes.tests;
+		vote_stats.escalations += slot->votes.escalations;
+		vote_stats.disagreements += slot->votes.disagreements;
+		done = first + n;
+
+		__atomic_store_n(&s->printed, c + 1, __ATOMIC_RELEASE);
+	}
+
+	/* Workers may be waiting for slots we will never drain */
+	if (failed || stop_tests) {
+		for (unsigned long i = 0; i < workers; i++)
+			kill(pids[i], SIGKILL);
+	}
+
+	while (wait(NULL) > 0)
+		/* Reap all workers */ ;
+
+	free(pids);
+	munmap(s, size);
+
+	/* Don't leave a hole in the output, do what is left ourselves */
+	if (failed) {
+		print("finishing serially from seed ");
+		putlong(seed + done);
+		print("\r\n");
+
+		for (unsigned long i = done; i < nr_tests && !stop_tests; i++)
+			tb_ticks += run_one_test(seed + i, nr_insns);
+	}
+
+	print("timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+
+	return true;
+}
+#endif
+
+#if __STDC_HOSTED__ == 1
+/*
+ * Pipelined test_many (set pipeline 1). A generator thread builds test
+ * cases into a ring of staging buffers, the main thread copies each one
+ * into the code page and runs it pinned to its CPU, and an output thread
+ * hashes and prints the results. The code page and memory window are the
+ * same as the serial path and the save area address drops out of the
+ * hash, so the results are identical.
+ *
+ * The staging buffers can't be run in place: a taken bcl leaves its own
+ * address in LR, which is part of the hash. The copy skips the prolog,
+ * which is the same for every seed, and only the copied part gets an
+ * icache flush, the same as generate_testcase on the serial path.
+ *
+ * The main thread runs the test cases because the backend's signal
+ * handling (alternate stack, watchdog) is set up on it. SIGALRM is
+ * blocked in the helper threads so the watchdog only ever hits it.
+ */
+static bool pipeline;
+
+#define PIPE_SLOTS	4
+#define PIPE_CODE_SIZE	((MAX_INSNS + SLACK) * sizeof(uint32_t))
+
+struct pipe_slot {
+	unsigned long len;
+	unsigned long prolog_len;
+	unsigned long votes;
+	long tb_diff;
+	struct testcase_fault fault;
+	/* The save area the code writes to, and its GPR table */
+	unsigned long gprs[NGPRS + GPR_TABLE_WORDS];
+	uint8_t code[PIPE_CODE_SIZE];
+};
+
+static struct pipe_state {
+	unsigned long seed, nr_insns, nr_tests;
+	/* Seeds through each stage, slot n % PIPE_SLOTS holds seed + n */
+	unsigned long generated, executed, printed;
+	bool gen_done, exec_done;
+	struct pipe_slot slots[PIPE_SLOTS];
+} pipe_state;
+
+static void *pipe_generate(void *arg)
+{
+	struct pipe_state *p = arg;
+
+	for (unsigned long n = 0; n < p->nr_tests; n++) {
+		struct pipe_slot *slot = &p->slots[n % PIPE_SLOTS];
+		void *end;
+
+		while (n >= __atomic_load_n(&p->printed, __ATOMIC_ACQUIRE) +
+			    PIPE_SLOTS && !__atomic_load_n(&stop_tests,
+							   __ATOMIC_RELAXED))
+			sched_yield();
+
+		if (__atomic_load_n(&stop_tests, __ATOMIC_RELAXED))
+			break;
+
+		end = generate_staged(slot->code, mem_ptr+MEM_SIZE/2,
+				      slot->gprs, p->seed + n, p->nr_insns,
+				      &slot->prolog_len);
+		slot->len = end - (void *)slot->code;
+
+		__atomic_store_n(&p->generated, n + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&p->gen_done, true, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static void *pipe_output(void *arg)
+{
+	struct pipe_state *p = arg;
+
+	for (unsigned long n = 0; ; n++) {
+		struct pipe_slot *slot = &p->slots[n % PIPE_SLOTS];
+
+		while (n >= __atomic_load_n(&p->executed, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&p->exec_done, __ATOMIC_ACQUIRE) &&
+			    n >= __atomic_load_n(&p->executed, __ATOMIC_ACQUIRE))
+				return NULL;
+			sched_yield();
+		}
+
+		/* Keep draining after a golden stop so nobody waits on us */
+		if (!stop_tests) {
+			last_votes = slot->votes;
+			if (!print_fault(p->seed + n, &slot->fault)) {
+				/* GPR 31 was our scratch space, clear it */
+				slot->gprs[31] = 0;
+				print_hash(p->seed + n, hash_gprs(slot->gprs),
+					   slot->tb_diff);
+			}
+		}
+
+		__atomic_store_n(&p->printed, n + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static bool run_many_tests_pipeline(unsigned long seed, unsigned long nr_insns,
+				    unsigned long nr_tests)
+{
+	struct pipe_state *p = &pipe_state;
+	pthread_t gen_thread, out_thread;
+	cpu_set_t saved, set;
+	sigset_t alrm, old;
+	long tb_ticks = 0;
+	int cpu;
+
+	if (nr_insns > MAX_INSNS)
+		return false;
+
+	p->seed = seed;
+	p->nr_insns = nr_insns;
+	p->nr_tests = nr_tests;
+	p->generated = p->executed = p->printed = 0;
+	p->gen_done = p->exec_done = false;
+
+	cpu = sched_getcpu();
+	if (cpu < 0 || sched_getaffinity(0, sizeof(saved), &saved))
+		return false;
+
+	/* Keep the helpers off the test CPU if there is anywhere else */
+	set = saved;
+	CPU_CLR(cpu, &set);
+	if (!CPU_COUNT(&set))
+		set = saved;
+
+	flush_output();
+
+	sigemptyset(&alrm);
+	sigaddset(&alrm, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &alrm, &old);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	if (pthread_create(&gen_thread, NULL, pipe_generate, p)) {
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		sched_setaffinity(0, sizeof(saved), &saved);
+		return false;
+	}
+	if (pthread_create(&out_thread, NULL, pipe_output, p)) {
+		/* Drain it ourselves so the generator can finish */
+		__atomic_store_n(&stop_tests, true, __ATOMIC_RELAXED);
+		pthread_join(gen_thread, NULL);
+		stop_tests = false;
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		sched_setaffinity(0, sizeof(saved), &saved);
+		return false;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	for (unsigned long n = 0; ; n++) {
+		struct pipe_slot *slot = &p->slots[n % PIPE_SLOTS];
+		unsigned long disagreements;
+
+		while (n >= __atomic_load_n(&p->generated, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&p->gen_done, __ATOMIC_ACQUIRE) &&
+			    n >= __atomic_load_n(&p->generated, __ATOMIC_ACQUIRE))
+				break;
+			sched_yield();
+		}
+		if (n >= __atomic_load_n(&p->generated, __ATOMIC_ACQUIRE))
+			break;
+
+		install_testcase(insns_ptr, slot->code, slot->len,
+				 slot->prolog_len);
+
+		arm_watchdog(nr_insns);
+		disagreements = vote_stats.disagreements;
+		slot->tb_diff = execute_testcase(insns_ptr, slot->gprs, mem_ptr);
+		slot->votes = 1 + vote_stats.disagreements - disagreements;
+		slot->fault = testcase_fault;
+		tb_ticks += slot->tb_diff;
+
+		__atomic_store_n(&p->executed, n + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&p->exec_done, true, __ATOMIC_RELEASE);
+	pthread_join(gen_thread, NULL);
+	pthread_join(out_thread, NULL);
+	sched_setaffinity(0, sizeof(saved), &saved);
+
+	print("timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+
+	return true;
+}
+#endif
+
+static void run_many_tests(unsigned long seed, unsigned long nr_insns,
+			   unsigned long nr_tests)
+{
+	long tb_ticks = 0;
+
+	/* Once, rather than for every seed in every path below */
+	if (nr_insns > MAX_INSNS) {
+		print("Increase MAX_INSNS\r\n");
+		return;
+	}
+
+	announce_profile();
+
+#if __STDC_HOSTED__ == 1
+	/* Register dumps and instruction listings stay serial */
+	if (pipeline && !registers && !insns &&
+	    run_many_tests_pipeline(seed, nr_insns, nr_tests))
+		return;
+
+	if (nr_workers > 1 && !registers && !insns && nr_tests > CHUNK_SIZE &&
+	    run_many_tests_parallel(seed, nr_insns, nr_tests))
+		return;
+#endif
+
+	if (use_packed(nr_insns)) {
+		run_many_tests_packed(seed, nr_insns, nr_tests);
+		return;
+	}
+
+	for (unsigned long i = 0; i < nr_tests && !stop_tests; i++) {
+		tb_ticks += run_one_test(seed, nr_insns);
+		seed++;
+	}
+	print("timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+}
+
+/*
+ * Fold the hashes of each block of block_size seeds into one digest and
+ * print only that, to cut down on console traffic. The digest is 64 bit
+ * FNV-1a over the per seed hashes in seed order, see range_check.py.
+ */
+#define FNV_OFFSET	0xcbf29ce484222325UL
+#define FNV_PRIME	0x100000001b3UL
+
+static void run_range_tests(unsigned long seed, unsigned long nr_insns,
+			    unsigned long nr_tests, unsigned long block_size)
+{
+	long tb_ticks = 0;
+
+	if (nr_insns > MAX_INSNS) {
+		print("Increase MAX_INSNS\r\n");
+		return;
+	}
+
+	if (!block_size)
+		block_size = 1;
+
+	announce_profile();
+
+	for (unsigned long i = 0; i < nr_tests; i += block_size) {
+		uint64_t digest = FNV_OFFSET;
+		unsigned long n = nr_tests - i;
+
+		if (n > block_size)
+			n = block_size;
+
+		for (unsigned long j = 0; j < n; j++) {
+			long tb_diff;
+
+			/* Faults are reported and fold in as 0 */
+			digest ^= run_one_hash(seed + i + j, nr_insns,
+					       &tb_diff);
+			digest *= FNV_PRIME;
+			tb_ticks += tb_diff;
+			report_fault(seed + i + j);
+		}
+
+		putlong(seed + i);
+		print(" ");
+		puthex(digest);
+		print("\r\n");
+	}
+	print("timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+}
+
+#ifdef GOLDEN_TABLE
+/* Check against the linked in golden table, only printing mismatches */
+static void selfcheck(void)
+{
+	unsigned long bad = 0;
+	long tb_ticks = 0;
+
+	if (hash_type != JENKINS) {
+		print("selfcheck needs the jenkins checksum\r\n");
+		return;
+	}
+
+	for (unsigned long i = 0; i < golden_count; i++) {
+		unsigned long seed = golden_first_seed + i;
+		uint64_t hash;
+		long tb_diff;
+
+		hash = run_one_hash(seed, golden_nr_insns, &tb_diff);
+		tb_ticks += tb_diff;
+
+		if (report_fault(seed)) {
+			bad++;
+		} else if (hash != golden_hashes[i]) {
+			putlong(seed);
+			print(" ");
+			puthex(hash);
+			print(" expected ");
+			puthex(golden_hashes[i]);
+			print("\r\n");
+			bad++;
+		}
+	}
+
+	print("selfcheck ");
+	putlong(golden_count);
+	print(" tests ");
+	putlong(bad);
+	print(" mismatches, timebase delta = ");
+	putlong(tb_ticks);
+	print("\r\n");
+}
+#endif
+
+#if __STDC_HOSTED__ == 1
+/* CPU to run reference test cases on for bisect, -1 to ask the console */
+static long ref_cpu = -1;
+
+static bool reference_cpu_hash(unsigned long seed, unsigned long nr_insns,
+			       uint64_t *hash)
+{
+	int fds[2];
+	pid_t pid;
+	bool ok;
+
+	if (pipe(fds))
+		return false;
+
+	/* Don't let the child inherit unflushed output */
+	flush_output();
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == 0) {
+		cpu_set_t set;
+		long tb_diff;
+
+		close(fds[0]);
+		CPU_ZERO(&set);
+		CPU_SET(ref_cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			_exit(1);
+
+		*hash = run_one_hash(seed, nr_insns, &tb_diff);
+		if (write(fds[1], hash, sizeof(*hash)) != sizeof(*hash))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	ok = pid > 0 && read(fds[0], hash, sizeof(*hash)) == sizeof(*hash);
+	close(fds[0]);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+
+	return ok;
+}
+#endif
+
+#if __STDC_HOSTED__ == 1
+/*
+ * Fleet screening. One worker is pinned to each CPU we are allowed to run
+ * on and every worker runs the same seeds, then the hashes for each seed
+ * are compared across CPUs. A CPU that disagrees with the majority is
+ * reported, as that is a core silently getting the wrong answer.
+ *
+ * With a time budget workers stop where they are when it runs out, and
+ * only the seeds that at least two CPUs got to are compared. With rotate
+ * workers go round the seed range again until the budget runs out, so
+ * fast and slow cores all finish together. A seed that hashes differently
+ * the second time round on the same CPU counts as unstable.
+ */
+static bool rotate;
+
+struct screen_state {
+	unsigned long done[CPU_SETSIZE];	/* tests run per worker */
+	unsigned long unstable[CPU_SETSIZE];
+	uint64_t hashes[];			/* [worker][seed] */
+};
+
+static void screen_worker(struct screen_state *s, unsigned long w,
+			  unsigned long seed, unsigned long nr_insns,
+			  unsigned long nr_tests, unsigned long deadline)
+{
+	uint64_t *hashes = &s->hashes[w * nr_tests];
+
+	for (unsigned long i = 0; i < nr_tests || (rotate && deadline); i++) {
+		unsigned long n = i % nr_tests;
+		uint64_t hash;
+		long tb_diff;
+
+		if (deadline && read_timebase() >= deadline)
+			break;
+
+		hash = run_one_hash(seed + n, nr_insns, &tb_diff);
+		if (i >= nr_tests && hash != hashes[n])
+			s->unstable[w]++;
+		else
+			hashes[n] = hash;
+		s->done[w] = i + 1;
+	}
+}
+
+static bool screen_ran(struct screen_state *s, unsigned long w,
+		       unsigned long n)
 {
-	print(str);
+	return n < s->done[w];
 }
 
-static bool registers;
-static bool insns;
-static enum { JENKINS, XOR } hash_type = JENKINS;
-static void *insns_ptr;
-static void *mem_ptr;
-
-static const char *extra_names[4] = { "CR", "LR", "CTR", "XER" };
-
-static long run_one_test(unsigned long seed, unsigned long nr_insns)
+static void screen(unsigned long seed, unsigned long nr_insns,
+		   unsigned long nr_tests, unsigned long seconds)
 {
-	unsigned long gprs[NGPRS];
-	long tb_diff;
+	unsigned long mismatches[CPU_SETSIZE] = { 0 };
+	unsigned long cpus[CPU_SETSIZE];
+	unsigned long nr_cpus = 0, compared = 0;
+	unsigned long deadline = 0;
+	struct screen_state *s;
+	cpu_set_t set;
+	size_t size;
+	pid_t *pids;
 
 	if (nr_insns > MAX_INSNS) {
 		print("Increase MAX_INSNS\r\n");
-		return 0;
+		return;
 	}
 
-	generate_testcase(insns_ptr, mem_ptr+MEM_SIZE/2, gprs, seed, nr_insns,
-			  insns, false);
-	tb_diff = execute_testcase(insns_ptr, gprs, mem_ptr);
+	if (!nr_tests || sched_getaffinity(0, sizeof(set), &set))
+		return;
 
-	/* GPR 31 was our scratch space, clear it */
-	gprs[31] = 0;
+	for (unsigned long cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[nr_cpus++] = cpu;
 
-	if (registers) {
-		for (unsigned long i = 0; i < NGPRS; i++) {
-			if (i < 32)
-				putlong(i);
-			else
-				print(extra_names[i-32]);
-			print(" ");
-			if (i != 31)
-				puthex(gprs[i]);
-			print("\r\n");
+	size = sizeof(*s) + nr_cpus * nr_tests * sizeof(uint64_t);
+	s = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (s == MAP_FAILED) {
+		print("Too many tests\r\n");
+		return;
+	}
+
+	pids = calloc(nr_cpus, sizeof(pid_t));
+	if (!pids) {
+		munmap(s, size);
+		return;
+	}
+
+	if (seconds)
+		deadline = read_timebase() + seconds * timebase_freq();
+
+	announce_profile();
+
+	/* Don't let the children inherit unflushed output */
+	flush_output();
+	fflush(stdout);
+
+	for (unsigned long w = 0; w < nr_cpus; w++) {
+		pids[w] = fork();
+		if (pids[w] == 0) {
+			CPU_ZERO(&set);
+			CPU_SET(cpus[w], &set);
+			if (sched_setaffinity(0, sizeof(set), &set))
+				_exit(1);
+
+			screen_worker(s, w, seed, nr_insns, nr_tests, deadline);
+			_exit(0);
 		}
-		print("Memory @ ");
-		puthex((unsigned long)mem_ptr);
-		for (unsigned long i = 0; i < MEM_SIZE; i += sizeof(unsigned long)) {
-			if (i % 32 == 0)
-				print("\r\n");
+	}
+
+	for (unsigned long w = 0; w < nr_cpus; w++) {
+		int status;
+
+		if (pids[w] < 0 || waitpid(pids[w], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			print("cpu ");
+			putlong(cpus[w]);
+			print(" worker failed\r\n");
+		}
+	}
+
+	for (unsigned long n = 0; n < nr_tests; n++) {
+		unsigned long votes = 0, ran = 0;
+		uint64_t majority = 0;
+
+		/* Boyer-Moore vote, then check it really is a majority */
+		for (unsigned long w = 0; w < nr_cpus; w++) {
+			uint64_t hash = s->hashes[w * nr_tests + n];
+
+			if (!screen_ran(s, w, n))
+				continue;
+
+			ran++;
+			if (!votes)
+				majority = hash;
+			if (hash == majority)
+				votes++;
 			else
-				print(" ");
-			puthex(*(unsigned long *)(mem_ptr + i));
+				votes--;
 		}
 
-		print("\r\n\r\n");
-	} else {
-		uint64_t hash = 0;
+		if (ran < 2)
+			continue;
+		compared++;
 
-		if (hash_type == XOR) {
-			for (unsigned long i = 0; i < NGPRS; i++)
-				hash ^= gprs[i];
-		} else {
-			hash = jhash2((uint32_t *)gprs,
-				      sizeof(gprs)/sizeof(uint32_t), 0);
+		votes = 0;
+		for (unsigned long w = 0; w < nr_cpus; w++)
+			if (screen_ran(s, w, n) &&
+			    s->hashes[w * nr_tests + n] == majority)
+				votes++;
+
+		if (votes == ran)
+			continue;
+
+		for (unsigned long w = 0; w < nr_cpus; w++) {
+			uint64_t hash = s->hashes[w * nr_tests + n];
+
+			if (!screen_ran(s, w, n) ||
+			    (votes * 2 > ran && hash == majority))
+				continue;
+
+			mismatches[w]++;
+			print("cpu ");
+			putlong(cpus[w]);
+			print(" seed ");
+			putlong(seed + n);
+			print(" ");
+			puthex(hash);
+			if (votes * 2 > ran) {
+				print(" expected ");
+				puthex(majority);
+			} else {
+				print(" no majority");
+			}
+			print("\r\n");
 		}
+	}
 
-		putlong(seed);
-		print(" ");
-		puthex(hash);
+	for (unsigned long w = 0; w < nr_cpus; w++) {
+		print("cpu ");
+		putlong(cpus[w]);
+		print(" tests ");
+		putlong(s->done[w]);
+		print(" mismatches ");
+		putlong(mismatches[w]);
+		if (s->unstable[w]) {
+			print(" unstable ");
+			putlong(s->unstable[w]);
+		}
 		print("\r\n");
 	}
+	print("compared ");
+	putlong(compared);
+	print(" seeds on ");
+	putlong(nr_cpus);
+	print(" cpus\r\n");
+
+	free(pids);
+	munmap(s, size);
+}
+#endif
 
-	return tb_diff;
+/* Read a hex number from the console, skipping any leftover line ends */
+static uint64_t read_hex_line(void)
+{
+	uint64_t val = 0;
+	bool digits = false;
+
+	while (1) {
+		char c = getchar_unbuffered();
+
+		if (c == '\r' || c == '\n') {
+			if (digits)
+				break;
+		} else if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+			   (c >= 'A' && c <= 'F')) {
+			val = val * 16 + __atoi_one(c);
+			digits = true;
+		}
+	}
+
+	return val;
 }
 
-static void run_many_tests(unsigned long seed, unsigned long nr_insns,
-			   unsigned long nr_tests)
+static bool reference_hash(unsigned long seed, unsigned long nr_insns,
+			   uint64_t *hash)
 {
-	long tb_ticks = 0;
+#if __STDC_HOSTED__ == 1
+	if (ref_cpu >= 0)
+		return reference_cpu_hash(seed, nr_insns, hash);
+#endif
 
-	for (unsigned long i = 0; i < nr_tests; i++) {
-		tb_ticks += run_one_test(seed, nr_insns);
-		seed++;
+	/* Ask whoever drives the console, eg microwatt/bisect.py */
+	print("reference ");
+	putlong(seed);
+	print(" ");
+	putlong(nr_insns);
+	print("?\r\n");
+	flush_output();
+	*hash = read_hex_line();
+
+	return true;
+}
+
+/*
+ * The test case for k instructions is a prefix of the one for n, so we
+ * can binary search for the shortest prefix that disagrees with the
+ * reference. Its last instruction is the first one to go wrong.
+ */
+static void bisect(unsigned long seed, unsigned long nr_insns,
+		   uint64_t expected)
+{
+	unsigned long gprs[NGPRS + GPR_TABLE_WORDS];
+	unsigned long lo = 0, hi = nr_insns;
+	const char *name;
+	uint64_t ref;
+	uint32_t insn;
+	long tb_diff;
+
+	if (nr_insns > MAX_INSNS) {
+		print("Increase MAX_INSNS\r\n");
+		return;
 	}
-	print("timebase delta = ");
-	putlong(tb_ticks);
+
+	if (run_one_hash(seed, nr_insns, &tb_diff) == expected) {
+		print("no divergence\r\n");
+		return;
+	}
+
+#if __STDC_HOSTED__ == 1
+	/* A reference core that gets it wrong too won't tell us anything */
+	if (ref_cpu >= 0 &&
+	    (!reference_hash(seed, nr_insns, &ref) || ref != expected)) {
+		print("reference does not match expected hash\r\n");
+		return;
+	}
+#endif
+
+	while (hi - lo > 1) {
+		unsigned long mid = lo + (hi - lo) / 2;
+		uint64_t hash = run_one_hash(seed, mid, &tb_diff);
+
+		if (!reference_hash(seed, mid, &ref)) {
+			print("reference failed\r\n");
+			return;
+		}
+
+		if (hash == ref)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	generate_testcase(insns_ptr, mem_ptr+MEM_SIZE/2, gprs, seed, hi,
+			  false, false);
+	name = last_generated_insn(&insn);
+	if (!name) {
+		print("divergence before the first insn\r\n");
+		return;
+	}
+
+	print("divergence at insn ");
+	putlong(hi - 1);
+	print(" ");
+	puthex(insn);
+	print(" ");
+	print(name);
 	print("\r\n");
 }
 
@@ -124,7 +1723,7 @@ static void non_interactive(char *filename, unsigned long seed,
 	void *end;
 	char name[PATH_MAX];
 	int fd;
-	unsigned long gprs[NGPRS];
+	unsigned long gprs[NGPRS + GPR_TABLE_WORDS];
 
 	if (nr_insns > MAX_INSNS) {
 		print("Increase MAX_INSNS\r\n");
@@ -153,6 +1752,7 @@ static void non_interactive(char *filename, unsigned long seed,
 
 	generate_testcase(insns_ptr, mem_ptr+MEM_SIZE/2, gprs, seed, nr_insns,
 			  insns, false);
+	arm_watchdog(nr_insns);
 	execute_testcase(insns_ptr, gprs, mem_ptr);
 
 	/* GPR 31 was our scratch space, clear it */
@@ -190,20 +1790,48 @@ static void sigint(microrl_t *pThis)
 #define   _CMD_SET_REGISTERS	"registers"
 #define   _CMD_SET_INSNS	"insns"
 #define   _CMD_SET_CHECKSUM	"checksum"
+#define   _CMD_SET_WORKERS	"workers"
+#define   _CMD_SET_REFCPU	"refcpu"
+#define   _CMD_SET_RELOCATABLE	"relocatable"
+#define   _CMD_SHOW_VOTES	"votes"
+#define   _CMD_SET_WATCHDOG	"watchdog"
+#define   _CMD_SET_TIMING	"timing"
+#define   _CMD_SET_SAMPLER	"sampler"
+#define   _CMD_SET_PROFILE	"profile"
+#define   _CMD_SET_FORMAT	"format"
+#define   _CMD_SET_GOLDEN	"golden"
+#define   _CMD_SET_MAXFAIL	"maxfail"
+#define   _CMD_SET_ROTATE	"rotate"
+#define   _CMD_SET_PIPELINE	"pipeline"
+#define   _CMD_SET_PACK		"pack"
+#define   _CMD_SET_GPRTABLE	"gprtable"
 #define _CMD_SHOW		"show"
 #define _CMD_TEST		"test"
 #define _CMD_TEST_MANY		"test_many"
+#define _CMD_TEST_RANGE		"test_range"
 #define _CMD_ENABLE		"enable"
 #define _CMD_DISABLE		"disable"
+#define _CMD_WEIGHT		"weight"
 #define _CMD_READ		"read"
 #define _CMD_MEMTEST		"memtest"
+#define _CMD_SELFCHECK		"selfcheck"
+#define _CMD_BISECT		"bisect"
+#define _CMD_NEXT		"next"
+#define _CMD_SCREEN		"screen"
 #define _CMD_QUIT		"quit"
 
 #define _NUM_OF_VER_SCMD 2
 
 static char *cmds[] = { _CMD_HELP, _CMD_VER, _CMD_SET, _CMD_SHOW, _CMD_TEST,
-		    _CMD_TEST_MANY, _CMD_ENABLE, _CMD_DISABLE, _CMD_READ,
-		    _CMD_MEMTEST };
+		    _CMD_TEST_MANY, _CMD_TEST_RANGE, _CMD_ENABLE, _CMD_DISABLE,
+		    _CMD_WEIGHT, _CMD_READ, _CMD_MEMTEST, _CMD_BISECT,
+#ifdef GOLDEN_TABLE
+		    _CMD_SELFCHECK,
+#endif
+#if __STDC_HOSTED__ == 1
+		    _CMD_NEXT, _CMD_SCREEN,
+#endif
+};
 
 #define NUM_CMDS (sizeof(cmds) / sizeof(cmds[0]))
 
@@ -244,10 +1872,22 @@ void usage(void)
 	print("\t\tshow [variable] [value]\r\n");
 	print("\t\ttest [seed] [nr_insns]\r\n");
 	print("\t\ttest_many [first_seed] [nr_insns] [nr_tests]\r\n");
+	print("\t\ttest_range [first_seed] [nr_insns] [nr_tests] [block_size]\r\n");
 	print("\t\tenable [insn]\r\n");
 	print("\t\tdisable [insn]\r\n");
+	print("\t\tweight [insn] [weight]\r\n");
+#if __STDC_HOSTED__ == 1
+	print("\t\tmemtest [start_addr end_addr]\r\n");
+#else
 	print("\t\tmemtest [start_addr] [end_addr]\r\n");
+#endif
+	print("\t\tbisect [seed] [nr_insns] [expected_hash]\r\n");
+#ifdef GOLDEN_TABLE
+	print("\t\tselfcheck\r\n");
+#endif
 #if __STDC_HOSTED__ == 1
+	print("\t\tnext\r\n");
+	print("\t\tscreen [first_seed] [nr_insns] [nr_tests] [seconds]\r\n");
 	print("\t\tquit\r\n");
 #endif
 }
@@ -271,7 +1911,81 @@ static void set_variable(const char *var, const char *val)
 			hash_type = JENKINS;
 		else
 			usage();
+	} else if (!strcmp(var, _CMD_SET_PROFILE)) {
+		if (!set_profile(val)) {
+			print("Profiles:\r\n");
+			list_profiles();
+		}
+	} else if (!strcmp(var, _CMD_SET_SAMPLER)) {
+		if (!strcmp(val, "compat"))
+			set_sampler(SAMPLER_COMPAT);
+		else if (!strcmp(val, "alias"))
+			set_sampler(SAMPLER_ALIAS);
+		else
+			usage();
+	} else if (!strcmp(var, _CMD_SET_WATCHDOG)) {
+		watchdog_per_insn = __atoi(val, 10);
+	} else if (!strcmp(var, _CMD_SET_TIMING)) {
+		if (!strcmp(val, "0"))
+			timing = false;
+		else if (!strcmp(val, "1"))
+			timing = true;
+	} else if (!strcmp(var, _CMD_SET_PACK)) {
+		pack = __atoi(val, 10);
+		if (pack > PACK_MAX)
+			pack = PACK_MAX;
+	} else if (!strcmp(var, _CMD_SET_FORMAT)) {
+		if (!strcmp(val, "text"))
+			format = TEXT;
+		else if (!strcmp(val, "binary"))
+			format = BINARY;
+		else
+			usage();
+	} else if (!strcmp(var, _CMD_SET_RELOCATABLE)) {
+		if (!strcmp(val, "0"))
+			set_relocatable(false);
+		else if (!strcmp(val, "1"))
+			set_relocatable(true);
+	} else if (!strcmp(var, _CMD_SET_GPRTABLE)) {
+		if (!strcmp(val, "0"))
+			set_gpr_table(false);
+		else if (!strcmp(val, "1"))
+			set_gpr_table(true);
+	}
+#if __STDC_HOSTED__ == 1
+	else if (!strcmp(var, _CMD_SET_WORKERS)) {
+		unsigned long n = __atoi(val, 10);
+
+		if (n)
+			nr_workers = n;
+		else
+			usage();
+	}
+	else if (!strcmp(var, _CMD_SET_REFCPU)) {
+		if (!strcmp(val, "off"))
+			ref_cpu = -1;
+		else
+			ref_cpu = __atoi(val, 10);
+	}
+	else if (!strcmp(var, _CMD_SET_GOLDEN)) {
+		load_golden(val);
+	}
+	else if (!strcmp(var, _CMD_SET_MAXFAIL)) {
+		max_mismatches = __atoi(val, 10);
+	}
+	else if (!strcmp(var, _CMD_SET_ROTATE)) {
+		if (!strcmp(val, "0"))
+			rotate = false;
+		else if (!strcmp(val, "1"))
+			rotate = true;
+	}
+	else if (!strcmp(var, _CMD_SET_PIPELINE)) {
+		if (!strcmp(val, "0"))
+			pipeline = false;
+		else if (!strcmp(val, "1"))
+			pipeline = true;
 	}
+#endif
 }
 
 static void show_variable(const char *var)
@@ -296,31 +2010,102 @@ static void show_variable(const char *var)
 			print("xor\r\n");
 		else
 			print("jenkins\r\n");
-	}
-}
-
-static uint8_t __atoi_one(uint8_t x)
-{
-	uint8_t v;
-
-	if (x >= 'a')
-		v = x - 'a' + 10;
-	else if (x >= 'A')
-		v = x - 'A' + 10;
-	else
-		v = x - '0';
-
-	return v;
-}
+	} else if (!strcmp(var, _CMD_SET_RELOCATABLE)) {
+		print("relocatable ");
 
-static unsigned long __atoi(const char *str, uint8_t base)
-{
-	unsigned long ret = 0;
+		if (get_relocatable())
+			print("1\r\n");
+		else
+			print("0\r\n");
+	} else if (!strcmp(var, _CMD_SET_GPRTABLE)) {
+		print("gprtable ");
 
-	for (unsigned long i = 0; str[i] != 0x0; i++)
-		ret = ret * base + __atoi_one(str[i]);
+		if (get_gpr_table())
+			print("1\r\n");
+		else
+			print("0\r\n");
+	} else if (!strcmp(var, _CMD_SET_PROFILE)) {
+		print_profile();
+	} else if (!strcmp(var, _CMD_SET_SAMPLER)) {
+		print("sampler ");
+		if (get_sampler() == SAMPLER_ALIAS)
+			print("alias\r\n");
+		else
+			print("compat\r\n");
+	} else if (!strcmp(var, _CMD_SET_WATCHDOG)) {
+		print("watchdog ");
+		putlong(watchdog_per_insn);
+		print("\r\n");
+	} else if (!strcmp(var, _CMD_SET_TIMING)) {
+		print("timing ");
 
-	return ret;
+		if (timing)
+			print("1\r\n");
+		else
+			print("0\r\n");
+	} else if (!strcmp(var, _CMD_SET_PACK)) {
+		print("pack ");
+		putlong(pack);
+		print("\r\n");
+	} else if (!strcmp(var, _CMD_SET_FORMAT)) {
+		print("format ");
+		if (format == BINARY)
+			print("binary\r\n");
+		else
+			print("text\r\n");
+	} else if (!strcmp(var, _CMD_SHOW_VOTES)) {
+		print("votes tests ");
+		putlong(vote_stats.tests);
+		print(" escalations ");
+		putlong(vote_stats.escalations);
+		print(" disagreements ");
+		putlong(vote_stats.disagreements);
+		print("\r\n");
+	}
+#if __STDC_HOSTED__ == 1
+	else if (!strcmp(var, _CMD_SET_WORKERS)) {
+		print("workers ");
+		putlong(nr_workers);
+		print("\r\n");
+	}
+	else if (!strcmp(var, _CMD_SET_REFCPU)) {
+		print("refcpu ");
+		if (ref_cpu < 0)
+			print("off");
+		else
+			putlong(ref_cpu);
+		print("\r\n");
+	}
+	else if (!strcmp(var, _CMD_SET_GOLDEN)) {
+		print("golden ");
+		if (!golden.buf)
+			print("off");
+		else if (golden.binary)
+			print("binary");
+		else
+			print("text");
+		print("\r\n");
+	}
+	else if (!strcmp(var, _CMD_SET_MAXFAIL)) {
+		print("maxfail ");
+		putlong(max_mismatches);
+		print("\r\n");
+	}
+	else if (!strcmp(var, _CMD_SET_ROTATE)) {
+		print("rotate ");
+		if (rotate)
+			print("1\r\n");
+		else
+			print("0\r\n");
+	}
+	else if (!strcmp(var, _CMD_SET_PIPELINE)) {
+		print("pipeline ");
+		if (pipeline)
+			print("1\r\n");
+		else
+			print("0\r\n");
+	}
+#endif
 }
 
 static void read_data(const char *addr)
@@ -331,50 +2116,6 @@ static void read_data(const char *addr)
 	print("\r\n");
 }
 
-static void memtest(const char *start, const char *end)
-{
-	unsigned long s = __atoi(start, 16);
-	unsigned long e = __atoi(end, 16);
-	unsigned long lfsr = 1;
-
-	print("Writing\r\n");
-	for (unsigned long i = s; i < e; i += sizeof(unsigned long)) {
-		unsigned long val;
-
-		lfsr = mylfsr(32, lfsr);
-		val = lfsr;
-		lfsr = mylfsr(32, lfsr);
-		val |= lfsr << 32;
-
-		*(unsigned long *)i = val;
-	}
-
-	print("Checking\r\n");
-	lfsr = 1;
-	for (unsigned long i = s; i < e; i += sizeof(unsigned long)) {
-		unsigned long val, tmp;
-
-		lfsr = mylfsr(32, lfsr);
-		val = lfsr;
-		lfsr = mylfsr(32, lfsr);
-		val |= lfsr << 32;
-
-		tmp = *(unsigned long *)i;
-
-		if (tmp != val) {
-			print("Bad data at ");
-			puthex(i);
-			print(" expected ");
-			puthex(val);
-			print(" got ");
-			puthex(tmp);
-			print("\r\n");
-		}
-	}
-
-	print("Done\r\n");
-}
-
 static int execute(microrl_t *pThis, int argc, const char *const *argv)
 {
 	if (!strcmp(argv[0], _CMD_HELP)) {
@@ -396,7 +2137,10 @@ static int execute(microrl_t *pThis, int argc, const char *const *argv)
 		seed = __atoi(argv[1], 10);
 		nr_insns = __atoi(argv[2], 10);
 
-		run_one_test(seed, nr_insns);
+		if (begin_results(seed, nr_insns, 1)) {
+			run_one_test(seed, nr_insns);
+			end_results();
+		}
 
 	} else if (!strcmp(argv[0], _CMD_TEST_MANY)) {
 		unsigned long seed;
@@ -410,7 +2154,26 @@ static int execute(microrl_t *pThis, int argc, const char *const *argv)
 		nr_insns = __atoi(argv[2], 10);
 		nr_tests = __atoi(argv[3], 10);
 
-		run_many_tests(seed, nr_insns, nr_tests);
+		if (begin_results(seed, nr_insns, nr_tests)) {
+			run_many_tests(seed, nr_insns, nr_tests);
+			end_results();
+		}
+
+	} else if (!strcmp(argv[0], _CMD_TEST_RANGE)) {
+		unsigned long seed;
+		unsigned long nr_insns;
+		unsigned long nr_tests;
+		unsigned long block_size;
+
+		if (argc != 5)
+			goto usage;
+
+		seed = __atoi(argv[1], 10);
+		nr_insns = __atoi(argv[2], 10);
+		nr_tests = __atoi(argv[3], 10);
+		block_size = __atoi(argv[4], 10);
+
+		run_range_tests(seed, nr_insns, nr_tests, block_size);
 
 	} else if (!strcmp(argv[0], _CMD_SET)) {
 		if (argc != 3)
@@ -426,21 +2189,68 @@ static int execute(microrl_t *pThis, int argc, const char *const *argv)
 		enable_insn(argv[1]);
 	} else if (!strcmp(argv[0], _CMD_DISABLE)) {
 		disable_insn(argv[1]);
+	} else if (!strcmp(argv[0], _CMD_WEIGHT)) {
+		if (argc != 3)
+			goto usage;
+
+		weight_insn(argv[1], __atoi(argv[2], 10));
 	} else if (!strcmp(argv[0], _CMD_READ)) {
 		if (argc != 2)
 			goto usage;
 
 		read_data(argv[1]);
 	} else if (!strcmp(argv[0], _CMD_MEMTEST)) {
-		if (argc != 3)
+#if __STDC_HOSTED__ == 1
+		/* With no addresses, test a region of our own */
+		if (argc == 1)
+			memtest_alloc(MEMTEST_SIZE, nr_workers);
+		else
+#endif
+		if (argc == 3)
+			memtest((void *)__atoi(argv[1], 16),
+				(void *)__atoi(argv[2], 16), 1);
+		else
+			goto usage;
+	} else if (!strcmp(argv[0], _CMD_BISECT)) {
+		if (argc != 4)
 			goto usage;
 
-		memtest(argv[1], argv[2]);
+		bisect(__atoi(argv[1], 10), __atoi(argv[2], 10),
+		       __atoi(argv[3], 16));
+	}
+#ifdef GOLDEN_TABLE
+	else if (!strcmp(argv[0], _CMD_SELFCHECK)) {
+		selfcheck();
 	}
+#endif
 #if __STDC_HOSTED__ == 1
 	else if (!strcmp(argv[0], _CMD_QUIT)) {
+		flush_output();
 		exit(0);
 	}
+	else if (!strcmp(argv[0], _CMD_NEXT)) {
+		unsigned long seed = resume.seed;
+		unsigned long nr_insns = resume.nr_insns;
+		unsigned long nr_tests = resume.end - resume.seed;
+
+		if (argc != 1)
+			goto usage;
+
+		/* Carry on with the rest of a test_many that stopped early */
+		if (!nr_tests) {
+			print("Nothing to resume\r\n");
+		} else if (begin_results(seed, nr_insns, nr_tests)) {
+			run_many_tests(seed, nr_insns, nr_tests);
+			end_results();
+		}
+	}
+	else if (!strcmp(argv[0], _CMD_SCREEN)) {
+		if (argc != 5)
+			goto usage;
+
+		screen(__atoi(argv[1], 10), __atoi(argv[2], 10),
+		       __atoi(argv[3], 10), __atoi(argv[4], 10));
+	}
 #endif
 
 	return 0;
@@ -461,10 +2271,19 @@ int main(int argc, char *argv[])
 #endif
 	microrl_set_sigint_callback(prl, sigint);
 
+	icache_init();
 	insns_ptr = init_testcase(MAX_INSNS + SLACK);
 	mem_ptr = init_memory();
+	default_fingerprint = generator_fingerprint();
 
 #if __STDC_HOSTED__ == 1
+	{
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if (n > 0)
+			nr_workers = n;
+	}
+
 	if (argc == 4) {
 		char *filename = argv[1];
 		unsigned long seed = strtoul(argv[2], NULL, 10);
@@ -472,12 +2291,16 @@ int main(int argc, char *argv[])
 
 		non_interactive(filename, seed, nr_insns);
 
+		flush_output();
 		exit(0);
 	}
 #endif
 
-	while (1)
+	while (1) {
+		/* Get everything out before we block waiting for input */
+		flush_output();
 		microrl_insert_char(prl, getchar_unbuffered());
+	}
 
 	//free_testcase(ptr);
 